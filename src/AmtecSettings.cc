@@ -103,7 +103,7 @@ void AmtecSettings::build_program_options( po::options_description &desc ) {
     ( "threshold,T" , po::value<double>( &threshold_ ) ,
       "Clustering threshold (default 0.3)" )
     ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
-      "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+      "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
     ( "clus-output-format" , po::value<string>( &clus_output_format_string_ ) ,
       "Clusters output format : CSV_FORMAT|SAMPLES_FORMAT (default SAMPLES_FORMAT)" )
     ( "clus-input-format" , po::value<string>( &clus_input_format_string_ ) ,
@@ -135,6 +135,8 @@ void AmtecSettings::decode_formats() {
     if( bitstring_separator_.empty() ) {
       bitstring_separator_ = " ";
     }
+  } else if( input_format_string_ == "FPS" ) {
+    input_format_ = FPS;
   } else {
     throw FingerprintInputFormatError( input_format_string_ );
   }
@@ -0,0 +1,95 @@
+//
+// file BinaryRecordScanner.cc
+// 16th October 2026
+//
+
+#include "BinaryRecordScanner.H"
+
+#include <cstring>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// ****************************************************************************
+BinaryRecordScanner::BinaryRecordScanner( FP_FILE_FORMAT fp_file_format ,
+                                          size_t num_bytes_in_fp ,
+                                          uint64_t first_offset ,
+                                          size_t record_interval ) :
+  fp_file_format_( fp_file_format ) , num_bytes_in_fp_( num_bytes_in_fp ) ,
+  offset_( first_offset ) , record_interval_( record_interval ) ,
+  state_( NAME_LEN ) , int_got_( 0 ) , to_skip_( 0 ) , num_records_( 0 ) ,
+  bad_( false ) {
+
+}
+
+// ****************************************************************************
+void BinaryRecordScanner::add( const unsigned char *buf , size_t len ) {
+
+  while( len && !bad_ ) {
+    if( to_skip_ ) {
+      size_t n = to_skip_ < len ? size_t( to_skip_ ) : len;
+      to_skip_ -= n;
+      buf += n;
+      len -= n;
+      offset_ += n;
+      if( !to_skip_ ) {
+        skipped();
+      }
+      continue;
+    }
+    if( NAME_LEN == state_ && !int_got_ && record_interval_
+        && !( num_records_ % record_interval_ ) ) {
+      record_starts_.push_back( offset_ );
+    }
+    int_bytes_[int_got_++] = *buf++;
+    --len;
+    ++offset_;
+    if( sizeof( int ) == int_got_ ) {
+      int_got_ = 0;
+      int val;
+      memcpy( &val , int_bytes_ , sizeof( int ) );
+      got_int( val );
+    }
+  }
+
+}
+
+// ****************************************************************************
+void BinaryRecordScanner::got_int( int val ) {
+
+  if( val < 0 ) {
+    bad_ = true;
+    return;
+  }
+  if( NAME_LEN == state_ ) {
+    ++num_records_;
+    state_ = NAME;
+    to_skip_ = val;
+  } else {
+    state_ = FP;
+    to_skip_ = uint64_t( val ) * sizeof( uint32_t );
+  }
+  if( !to_skip_ ) {
+    skipped();
+  }
+
+}
+
+// ****************************************************************************
+void BinaryRecordScanner::skipped() {
+
+  if( NAME == state_ ) {
+    if( FLUSH_FPS == fp_file_format_ ) {
+      state_ = FP;
+      to_skip_ = num_bytes_in_fp_;
+    } else {
+      state_ = NUM_FRAG_NUMS;
+    }
+  } else {
+    state_ = NAME_LEN;
+  }
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -0,0 +1,101 @@
+//
+// file BlockedGzipFile.cc
+// 16th October 2026
+//
+
+#include "BlockedGzipFile.H"
+#include "FileExceptions.H"
+#include "FingerprintIndex.H"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// the record interval of the index
+static const unsigned int BLOCKED_GZIP_RECORD_INTERVAL = 256;
+
+// ****************************************************************************
+BlockedGzipWriter::BlockedGzipWriter( const string &filename ,
+                                      int num_chars_in_fp ,
+                                      FP_FILE_FORMAT format ,
+                                      unsigned int block_size ) :
+  filename_( filename ) , block_size_( block_size ? block_size : 1 ) ,
+  gzfp_( 0 ) , member_out_( 0 ) , num_in_member_( 0 ) {
+
+  open_fp_file_for_writing( filename , num_chars_in_fp , format , gzfp_ );
+  try {
+    index_.reset( new FingerprintIndexWriter( filename , format ,
+                                              num_chars_in_fp , true , false ,
+                                              BLOCKED_GZIP_RECORD_INTERVAL ) );
+  } catch( ... ) {
+    gzclose( gzfp_ );
+    throw;
+  }
+
+}
+
+// ****************************************************************************
+BlockedGzipWriter::~BlockedGzipWriter() {
+
+  finish();
+
+}
+
+// ****************************************************************************
+void BlockedGzipWriter::start_member() {
+
+  member_out_ += gztell( gzfp_ );
+  if( Z_OK != gzclose( gzfp_ ) ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  struct stat st;
+  if( stat( filename_.c_str() , &st ) ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  // appending to a gzip file starts a new member
+  gzfp_ = gzopen( filename_.c_str() , "ab" );
+  if( !gzfp_ ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  index_->add_member( member_out_ , st.st_size );
+  num_in_member_ = 0;
+
+}
+
+// ****************************************************************************
+void BlockedGzipWriter::write( const FingerprintBase &fp ) {
+
+  if( num_in_member_ == block_size_ ) {
+    start_member();
+  }
+  index_->add_fp( member_out_ + gztell( gzfp_ ) , fp.get_name() ,
+                  fp.count_bits() );
+  fp.binary_write( gzfp_ );
+  ++num_in_member_;
+
+}
+
+// ****************************************************************************
+void BlockedGzipWriter::finish() {
+
+  if( !gzfp_ ) {
+    return;
+  }
+  if( Z_OK != gzclose( gzfp_ ) ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  gzfp_ = 0;
+  index_->finish( 0 );
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -81,7 +81,7 @@ void CadSettings::build_program_options( po::options_description &desc ) {
     ( "cluster-fp-file,F" , po::value<string>( &fp_file_ ) ,
       "Name of the fingerprint file for the input clusters." )
     ( "fingerprint-format" , po::value<string>( &fp_format_string_ ) ,
-      "Fingerprint file format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+      "Fingerprint file format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
     ( "cluster-file-format" , po::value<string>( &clus_format_string_ ) ,
       "Clusters input format : CSV_FORMAT|SAMPLES_FORMAT (default SAMPLES_FORMAT)" )
     ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
@@ -107,6 +107,8 @@ void CadSettings::decode_formats() {
     if( bitstring_separator_.empty() ) {
       bitstring_separator_ = " ";
     }
+  } else if( fp_format_string_ == "FPS" ) {
+    input_format_ = FPS;
   } else {
     throw FingerprintInputFormatError( fp_format_string_ );
   }
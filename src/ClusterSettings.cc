@@ -32,7 +32,8 @@ ClusterSettings::ClusterSettings( int argc , char **argv ) :
   output_format_string_( "SAMPLES_FORMAT" ) ,
   input_format_string_( "FLUSH_FPS" ) ,
   output_format_( SAMPLES_FORMAT ) , input_format_( FLUSH_FPS ) ,
-  binary_file_( false ) , fix_spaces_in_names_( false ) {
+  binary_file_( false ) , fix_spaces_in_names_( false ) ,
+  compact_frag_nums_( false ) , fold_bits_( 0 ) , num_threads_( 1 ) {
 
   po::options_description desc( "Allowed Options" );
   build_program_options( desc );
@@ -73,6 +74,15 @@ bool ClusterSettings::operator!() const {
     error_msg_ = string( "Invalid distance threshold " ) +
       boost::lexical_cast<string>( threshold_ ) + string( "." );
     return true;
+  } else if( fold_bits_ < 0 || fold_bits_ % 64 ) {
+    error_msg_ = string( "Invalid fold bits " ) +
+      boost::lexical_cast<string>( fold_bits_ ) +
+      string( ", must be a multiple of 64." );
+    return true;
+  } else if( num_threads_ < 1 ) {
+    error_msg_ = string( "Invalid number of threads " ) +
+      boost::lexical_cast<string>( num_threads_ ) + string( "." );
+    return true;
   }
 
   return false;
@@ -101,6 +111,10 @@ void ClusterSettings::send_contents_via_mpi( int dest_slave ) {
   mpi_send_string( bitstring_separator_ , dest_slave );
   i = int( fix_spaces_in_names_ );
   MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  i = int( compact_frag_nums_ );
+  MPI_Send( &i , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  MPI_Send( &fold_bits_ , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
+  MPI_Send( &num_threads_ , 1 , MPI_INT , dest_slave , 0 , MPI_COMM_WORLD );
 
 }
 
@@ -129,6 +143,10 @@ void ClusterSettings::receive_contents_via_mpi() {
   mpi_rec_string( 0 , bitstring_separator_ );
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   fix_spaces_in_names_ = static_cast<bool>( i );
+  MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  compact_frag_nums_ = static_cast<bool>( i );
+  MPI_Recv( &fold_bits_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &num_threads_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
 
 }
 
@@ -152,7 +170,7 @@ void ClusterSettings::build_program_options( po::options_description &desc ) {
     ( "verbose,V" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
       "Verbose" )
     ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
-      "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+      "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
     ( "output-format" , po::value<string>( &output_format_string_ ) ,
       "Output format : CSV_FORMAT|SAMPLES_FORMAT (default SAMPLES_FORMAT)" )
     ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
@@ -160,7 +178,13 @@ void ClusterSettings::build_program_options( po::options_description &desc ) {
     ( "frag-num-separator" , po::value<string>( &bitstring_separator_ ) ,
       "For fragment numbers input, the separator between numbers (defaults to space)." )
       ( "fix-spaces-in-names" , po::value<bool>( &fix_spaces_in_names_ )->zero_tokens()->default_value( false ) ,
-        "Changes spaces in fingerprint names to \'_\' so as not to mess up SAMPLES format file.");
+        "Changes spaces in fingerprint names to \'_\' so as not to mess up SAMPLES format file." )
+      ( "compact-frag-nums" , po::value<bool>( &compact_frag_nums_ )->zero_tokens()->default_value( false ) ,
+        "For fragment numbers input, keep the numbers compressed in memory, for big data sets at some cost in speed." )
+      ( "fold-bits" , po::value<int>( &fold_bits_ )->default_value( 0 ) ,
+        "For hashed fingerprints, screen pairs with copies folded to this many bits (a multiple of 64, e.g. 256 or 512) before the full calculation.  Default 0, no screening." )
+      ( "num-threads" , po::value<int>( &num_threads_ )->default_value( 1 ) ,
+        "Number of threads for making the neighbour lists, in each process of a parallel run (default 1)." );
   
 }
 
@@ -10,14 +10,21 @@
 #include "ByteSwapper.H"
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
+#include "FingerprintBlockReader.H"
+#include "FingerprintIndex.H"
+#include "FingerprintStore.H"
 #include "HashedFingerprint.H"
+#include "MappedFingerprintFile.H"
 #include "NotHashedFingerprint.H"
 #include "MagicInts.H"
 
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <sstream>
 
-#include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
 
 using namespace boost;
 using namespace std;
@@ -31,6 +38,83 @@ FingerprintBase::~FingerprintBase() {
 
 }
 
+// **************************************************************************
+// if threshold is a decimal fraction of no more than 9 places, give it back
+// as numer / denom.
+static bool decimal_fraction( double threshold , uint64_t &numer ,
+                              uint64_t &denom ) {
+
+  denom = 1;
+  for( int i = 0 ; i <= 9 ; ++i , denom *= 10 ) {
+    double scaled = threshold * double( denom );
+    double rounded = floor( scaled + 0.5 );
+    // a few bits either way for the binary representation and the multiply
+    if( fabs( scaled - rounded ) <= scaled * 1.0e-14 ) {
+      numer = uint64_t( rounded );
+      return true;
+    }
+  }
+
+  return false;
+
+}
+
+// **************************************************************************
+TanimotoThreshold::TanimotoThreshold( double threshold ) :
+  reject_all_( false ) , num_( 0 ) , sum_( 1 ) {
+
+  if( !( threshold >= 0.0 ) ) {
+    // nothing can be that close, and it catches NaN as well
+    reject_all_ = true;
+    return;
+  }
+  if( threshold >= 1.0 ) {
+    // everything's within 1.0, and num_ = 0 passes anything.
+    return;
+  }
+
+  // Thresholds are given in decimal, and 0.3, for example, isn't exactly
+  // representable in binary.  Taking it as the nearest double would put a
+  // pair at a distance of exactly 3/10 on one side of it or the other
+  // depending on the rounding, which isn't what anyone typing 0.3 means, so
+  // if it looks like a decimal, that's what's used.
+  uint64_t numer , denom;
+  if( decimal_fraction( threshold , numer , denom ) ) {
+    num_ = denom - numer;
+    sum_ = denom + num_;
+    return;
+  }
+
+  // otherwise it's exactly mant * 2^exp, with mant a whole number of up to
+  // 53 bits and exp negative since threshold < 1.  Take out factors of 2 to
+  // keep den as small as possible.
+  int exp;
+  double frac = frexp( threshold , &exp );
+  uint64_t mant = uint64_t( ldexp( frac , 53 ) );
+  exp -= 53;
+  while( !( mant & 1 ) ) {
+    mant >>= 1;
+    ++exp;
+  }
+  if( exp < -90 ) {
+    // the smallest non-zero distance is 1 / ( a + b - c ), which can't be
+    // below 2^-32 with int counts.  The threshold is less than 2^-37 here,
+    // so is the same as 0, which only accepts identical fingerprints.
+    num_ = 1;
+    sum_ = 2;
+    return;
+  }
+
+  unsigned __int128 den = static_cast<unsigned __int128>( 1 ) << -exp;
+  num_ = den - mant;
+  sum_ = den + num_;
+
+}
+
+// **************************************************************************
+// the zlib buffer size for text fingerprint files
+static const unsigned int TEXT_BUFFER_SIZE = 131072;
+
 // **************************************************************************
 // open a possibly compressed fingerprint file for reading.  zlib can read
 // an uncompressed file with the same routines as a compressed one.
@@ -39,7 +123,8 @@ void open_fp_file_for_reading( const string &fp_file ,
                                FP_FILE_FORMAT expected_format ,
                                bool &byte_swapping , gzFile &fp ) {
 
-  if( FRAG_NUMS == expected_format || BITSTRINGS == expected_format ) {
+  if( FRAG_NUMS == expected_format || BITSTRINGS == expected_format
+      || FPS == expected_format ) {
     open_fp_file_for_reading( fp_file , fp );
     return;
   }
@@ -74,6 +159,13 @@ void open_fp_file_for_reading( const string &fp_file ,
       ++num_ints_in_fp;
     }
     HashedFingerprint::set_num_ints( num_ints_in_fp );
+  } else if( FP2_MAGIC_INT == file_type || BUGGERED_FP2_MAGIC_INT == file_type ) {
+    // the records aren't in a stream, so it has to be read with a
+    // MappedFingerprintFile by whoever's calling this, if they know how.
+    cerr << fp_file << " is a version 2 flush file, which this program can't"
+         << " read this way." << endl << "Use merge_fp_files to convert it to"
+         << " a version 1 file." << endl;
+    exit( 1 );
   } else if( FN_MAGIC_INT == file_type || BUGGERED_FN_MAGIC_INT == file_type ) {
     if( expected_format != BIN_FRAG_NUMS ) {
       throw FingerprintFileError( fp_file , expected_format ,
@@ -99,7 +191,27 @@ void open_fp_file_for_reading( const std::string &fp_file , gzFile &fp ) {
   if( !fp ) {
     throw DACLIB::FileReadOpenError( fp_file.c_str() );
   }
-  
+  // the lines are read a buffer's worth at a time, and bitstring lines are
+  // long, so make the buffer bigger than the default 8K.
+  gzbuffer( fp , TEXT_BUFFER_SIZE );
+
+}
+
+// **************************************************************************
+// the header lines of an FPS file.  The number of bits is the one the
+// fingerprints were read with if that's known, which it isn't for a flush
+// file, otherwise all of them, padding included.  It has to agree with what
+// HashedFingerprint::fps_write does.
+static string fps_header( int num_chars_in_fp ) {
+
+  unsigned int num_bits = HashedFingerprint::num_bits();
+  if( !num_bits || ( num_bits + 31 ) / 32 != unsigned( num_chars_in_fp + 3 ) / 4 ) {
+    num_bits = num_chars_in_fp * 8;
+  }
+  ostringstream oss;
+  oss << "#FPS1" << endl << "#num_bits=" << num_bits << endl;
+  return oss.str();
+
 }
 
 // **************************************************************************
@@ -127,6 +239,13 @@ void open_fp_file_for_writing( const std::string &fp_file , int num_chars_in_fp
   } else if( BIN_FRAG_NUMS == file_format ) {
     gzwrite( fp , reinterpret_cast<const void *>( &FN_MAGIC_INT ) ,
              sizeof( unsigned int ) );
+  } else {
+    // bitstring lines are long, so compress them in bigger pieces
+    gzbuffer( fp , TEXT_BUFFER_SIZE );
+    if( FPS == file_format ) {
+      string header = fps_header( num_chars_in_fp );
+      gzwrite( fp , header.data() , header.length() );
+    }
   }
 
 }
@@ -155,24 +274,57 @@ void open_fp_file_for_writing( const std::string &fp_file , int num_chars_in_fp
   } else if( BIN_FRAG_NUMS == file_format ) {
     fwrite( reinterpret_cast<const void *>( &FN_MAGIC_INT ) ,
             sizeof( unsigned int ) , 1 , fp );
+  } else if( FPS == file_format ) {
+    string header = fps_header( num_chars_in_fp );
+    fwrite( header.data() , 1 , header.length() , fp );
   }
 
 }
 
 // **************************************************************************
-// read fp up to next
-string read_full_line( gzFile fp ) {
+// the size of the pieces read_full_line reads lines in
+static const int LINE_CHUNK_SIZE = 4096;
 
-  char c;
-  string full_line;
-  while( 1 ) {
-    c = gzgetc( fp );
-    if( gzeof( fp ) || c =='\n' ) {
-      break;
+// **************************************************************************
+bool read_full_line( gzFile fp , string &full_line ) {
+
+  full_line.clear();
+  char buf[LINE_CHUNK_SIZE];
+  while( gzgets( fp , buf , LINE_CHUNK_SIZE ) ) {
+    size_t len = strlen( buf );
+    if( len && '\n' == buf[len - 1] ) {
+      full_line.append( buf , len - 1 );
+      return true;
     }
-    full_line += c;
+    full_line.append( buf , len );
   }
+  return !full_line.empty();
+
+}
 
+// **************************************************************************
+bool read_full_line( FILE *fp , string &full_line ) {
+
+  full_line.clear();
+  char buf[LINE_CHUNK_SIZE];
+  while( fgets( buf , LINE_CHUNK_SIZE , fp ) ) {
+    size_t len = strlen( buf );
+    if( len && '\n' == buf[len - 1] ) {
+      full_line.append( buf , len - 1 );
+      return true;
+    }
+    full_line.append( buf , len );
+  }
+  return !full_line.empty();
+
+}
+
+// **************************************************************************
+// read fp up to next
+string read_full_line( gzFile fp ) {
+
+  string full_line;
+  read_full_line( fp , full_line );
   return full_line;
 
 }
@@ -181,33 +333,49 @@ string read_full_line( gzFile fp ) {
 // read fp up to next
 string read_full_line( FILE *fp ) {
 
-  char c;
   string full_line;
-  while( 1 ) {
-    c = fgetc( fp );
-    if( feof( fp ) || c =='\n' ) {
-      break;
-    }
-    full_line += c;
+  read_full_line( fp , full_line );
+  return full_line;
+
+}
+
+// **************************************************************************
+void write_text( gzFile fp , const char *buf , size_t len ) {
+
+  if( len ) {
+    gzwrite( fp , buf , len );
   }
 
-  return full_line;
+}
+
+// **************************************************************************
+void write_text( FILE *fp , const char *buf , size_t len ) {
+
+  fwrite( buf , 1 , len , fp );
 
 }
 
 // **************************************************************************
-// for use in ascii_read, to convert the separator
+// for use in ascii_read, to convert the separator.  sep is taken
+// literally, and replaced left to right.
 string convert_sep_to_new_sep( const string &ins , const string &sep ,
                                const string &new_sep ) {
 
-  ostringstream t;
-  ostream_iterator<char,char> oi( t );
-  // set it up not to use any special characters
-  regex e1( sep , boost::regex::literal );
-  regex_replace( oi , ins.begin() , ins.end() , e1 , new_sep ,
-                 boost::match_default | boost::format_all );
+  if( sep.empty() || string::npos == ins.find( sep ) ) {
+    return ins;
+  }
+  string outs;
+  outs.reserve( ins.length() );
+  size_t start = 0;
+  for( size_t pos = ins.find( sep ) ; string::npos != pos ;
+       pos = ins.find( sep , start ) ) {
+    outs.append( ins , start , pos - start );
+    outs += new_sep;
+    start = pos + sep.length();
+  }
+  outs.append( ins , start , string::npos );
 
-  return t.str();
+  return outs;
 
 }
 
@@ -241,6 +409,20 @@ void read_bitstrings_file( gzFile &fp , const string &bitstring_separator ,
 
 }
 
+// ***************************************************************************
+void read_fps_file( gzFile &fp , vector<FingerprintBase *> &fps ) {
+
+  HashedFingerprint next_fp( "DUMMY" );
+
+  while( 1 ) {
+    if( !next_fp.fps_read( fp ) ) {
+      break;
+    }
+    fps.push_back( new HashedFingerprint( next_fp ) );
+  }
+
+}
+
 // ***************************************************************************
 void read_frag_nums_file( gzFile &fp ,
                           const string &bitstring_separator ,
@@ -289,6 +471,9 @@ void read_fp_file( gzFile &fp , bool byteswapping ,
   case BIN_FRAG_NUMS :
     read_bin_frag_nums_file( fp , byteswapping , fps );
     break;
+  case FPS :
+    read_fps_file( fp , fps );
+    break;
   }
 
 }
@@ -298,6 +483,18 @@ void read_fp_file( const string &file , FP_FILE_FORMAT input_format ,
                    const string &bitstring_separator ,
                    vector<FingerprintBase *> &fps ) {
 
+  if( FLUSH_FPS == input_format && MappedFingerprintFile::flush_v2( file ) ) {
+    MappedFingerprintFile mapped( file , input_format );
+    fps.reserve( fps.size() + mapped.size() );
+    FingerprintView fp;
+    while( mapped.next( fp ) ) {
+      // the constructor copies the bits
+      unsigned int *bits = const_cast<unsigned int *>( reinterpret_cast<const unsigned int *>( fp.bits_ ) );
+      fps.push_back( new HashedFingerprint( fp.name() , bits ) );
+    }
+    return;
+  }
+
   gzFile gzfp = 0;
   bool byteswapping = false;
   if( FLUSH_FPS == input_format || BIN_FRAG_NUMS == input_format ) {
@@ -350,6 +547,16 @@ FingerprintBase *read_next_fp_from_file( gzFile &fp , bool byteswapping ,
         new_fp = 0;
       }
       break;
+    case FPS :
+      {
+        HashedFingerprint *hfp = new HashedFingerprint;
+        if( !hfp->fps_read( fp ) ) {
+          delete hfp;
+          hfp = 0;
+        }
+        new_fp = hfp;
+      }
+      break;
     }
   } catch( HashedFingerprintLengthError &e ) {
     cerr << e.what() << endl;
@@ -410,6 +617,217 @@ void read_fps_from_file( gzFile &fp_file , bool byteswapping ,
 
 }
 
+// ***************************************************************************
+// space for reading fingerprints into a FingerprintStore, re-used for each
+// one so nothing is allocated per fingerprint once it's big enough.  The
+// binary formats are read straight into name and nums, in the same way as
+// HashedFingerprint::binary_read and NotHashedFingerprint::binary_read.  The
+// ASCII ones are parsed by the fingerprint classes as usual, made when
+// they're first needed.
+class StoreReadSpace {
+public :
+
+  bool read_next_fp( gzFile &fp , bool byteswapping ,
+                     FP_FILE_FORMAT file_format ,
+                     const string &bitstring_separator ,
+                     FingerprintStore &fps );
+
+private :
+  string                           name_;
+  vector<uint32_t>                 nums_;
+  scoped_ptr<HashedFingerprint>    hashed_fp_;
+  scoped_ptr<NotHashedFingerprint> not_hashed_fp_;
+
+  bool read_name( gzFile &fp , bool byteswapping );
+};
+
+// ***************************************************************************
+bool StoreReadSpace::read_name( gzFile &fp , bool byteswapping ) {
+
+  int name_len;
+  gzread( fp , &name_len , sizeof( int ) );
+  if( gzeof( fp ) ) {
+    return false;
+  }
+  if( byteswapping ) {
+    DACLIB::byte_swapper<int>( name_len );
+  }
+  name_.resize( name_len , ' ' );
+  if( name_len ) {
+    gzread( fp , &name_[0] , name_len );
+  }
+  return true;
+
+}
+
+// ***************************************************************************
+bool StoreReadSpace::read_next_fp( gzFile &fp , bool byteswapping ,
+                                   FP_FILE_FORMAT file_format ,
+                                   const string &bitstring_separator ,
+                                   FingerprintStore &fps ) {
+
+  switch( file_format ) {
+  case FLUSH_FPS :
+    if( !read_name( fp , byteswapping ) ) {
+      return false;
+    }
+    nums_.resize( HashedFingerprint::num_ints() );
+    gzread( fp , &nums_[0] , nums_.size() * sizeof( unsigned int ) );
+    fps.add_hashed( name_ , &nums_[0] );
+    break;
+  case BIN_FRAG_NUMS :
+    {
+      if( !read_name( fp , byteswapping ) ) {
+        return false;
+      }
+      int num_frag_nums;
+      gzread( fp , &num_frag_nums , sizeof( int ) );
+      if( byteswapping ) {
+        DACLIB::byte_swapper<int>( num_frag_nums );
+      }
+      nums_.resize( num_frag_nums );
+      if( num_frag_nums ) {
+        gzread( fp , &nums_[0] , num_frag_nums * sizeof( uint32_t ) );
+      }
+      fps.add_not_hashed( name_ , nums_.empty() ? 0 : &nums_[0] ,
+                          num_frag_nums );
+    }
+    break;
+  case BITSTRINGS :
+    if( !hashed_fp_ ) {
+      hashed_fp_.reset( new HashedFingerprint( "Dummy" ) );
+    }
+    if( !hashed_fp_->ascii_read( fp , bitstring_separator ) ) {
+      return false;
+    }
+    fps.add( *hashed_fp_ );
+    break;
+  case FRAG_NUMS :
+    if( !not_hashed_fp_ ) {
+      not_hashed_fp_.reset( new NotHashedFingerprint( "Dummy" ) );
+    }
+    if( !not_hashed_fp_->ascii_read( fp , bitstring_separator ) ) {
+      return false;
+    }
+    fps.add( *not_hashed_fp_ );
+    break;
+  case FPS :
+    if( !hashed_fp_ ) {
+      hashed_fp_.reset( new HashedFingerprint( "Dummy" ) );
+    }
+    if( !hashed_fp_->fps_read( fp ) ) {
+      return false;
+    }
+    fps.add( *hashed_fp_ );
+    break;
+  }
+
+  return true;
+
+}
+
+// ***************************************************************************
+void read_fp_file( gzFile &fp , bool byteswapping ,
+                   FP_FILE_FORMAT file_format ,
+                   const string &bitstring_separator ,
+                   FingerprintStore &fps ) {
+
+  StoreReadSpace space;
+  while( space.read_next_fp( fp , byteswapping , file_format ,
+                             bitstring_separator , fps ) ) {
+  }
+
+}
+
+// **************************************************************************
+void read_fp_file( const string &file , FP_FILE_FORMAT input_format ,
+                   const string &bitstring_separator ,
+                   FingerprintStore &fps ) {
+
+  read_fps_from_file( file , input_format , bitstring_separator , 0 ,
+                      numeric_limits<unsigned int>::max() , fps );
+
+}
+
+// **************************************************************************
+void read_fps_from_file( gzFile &fp_file , bool byteswapping ,
+                         FP_FILE_FORMAT file_format ,
+                         const std::string &bitstring_separator ,
+                         unsigned int first_fp , unsigned int num_fps ,
+                         FingerprintStore &fps ) {
+
+  StoreReadSpace space;
+  try {
+    // spin through to first fp of interest
+    FingerprintStore skipped;
+    for( unsigned int i = 0 ; i < first_fp ; ++i ) {
+      skipped.clear();
+      if( !space.read_next_fp( fp_file , byteswapping , file_format ,
+                               bitstring_separator , skipped ) ) {
+        // bad end
+        return;
+      }
+    }
+
+    for( unsigned int i = 0 ; i < num_fps ; ++i ) {
+      if( !space.read_next_fp( fp_file , byteswapping , file_format ,
+                               bitstring_separator , fps ) ) {
+        break;
+      }
+    }
+  } catch( HashedFingerprintLengthError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+}
+
+// **************************************************************************
+void read_fps_from_file( const string &file , FP_FILE_FORMAT input_format ,
+                         const string &bitstring_separator ,
+                         unsigned int first_fp , unsigned int num_fps ,
+                         FingerprintStore &fps ) {
+
+  // an index gets to first_fp quicker than stepping through the records
+  // before it, unless it's a version 2 file where it's immediate anyway.
+  if( first_fp && !MappedFingerprintFile::flush_v2( file ) ) {
+    scoped_ptr<FingerprintIndex> index( FingerprintIndex::open( file ,
+                                                                input_format ) );
+    if( index ) {
+      index->read_fps( first_fp , num_fps , fps );
+      return;
+    }
+  }
+
+  if( MappedFingerprintFile::mappable( file , input_format ) ) {
+    MappedFingerprintFile mapped( file , input_format );
+    if( mapped.flush_v2() ) {
+      // there's no point making room for more than there are
+      size_t num_left = first_fp < mapped.size() ? mapped.size() - first_fp : 0;
+      if( num_left < num_fps ) {
+        num_fps = num_left;
+      }
+      fps.reserve( fps.size() + num_fps );
+    }
+    mapped.seek( first_fp );
+    mapped.read_fps( num_fps , fps );
+    return;
+  }
+
+  gzFile gzfp = 0;
+  bool byteswapping = false;
+  if( FLUSH_FPS == input_format || BIN_FRAG_NUMS == input_format ) {
+    open_fp_file_for_reading( file , input_format , byteswapping , gzfp );
+  } else {
+    open_fp_file_for_reading( file , gzfp );
+  }
+
+  read_fps_from_file( gzfp , byteswapping , input_format ,
+                      bitstring_separator , first_fp , num_fps , fps );
+  gzclose( gzfp );
+
+}
+
 // **************************************************************************
 void decode_format_string( const string &format_string ,
                            FP_FILE_FORMAT &fp_file_format ,
@@ -429,32 +847,50 @@ void decode_format_string( const string &format_string ,
     if( bitstring_separator.empty() ) {
       bitstring_separator = " ";
     }
+  } else if( !format_string.empty() && "FPS" == format_string ) {
+    fp_file_format = FPS;
   } else {
     throw FingerprintInputFormatError( format_string );
   }
 
 }
 
+// **************************************************************************
+// the number of fingerprints read at a time by count_fps_in_file and
+// get_fp_names
+static const unsigned int SCAN_BLOCK_SIZE = 4096;
+
 // **************************************************************************
 unsigned int count_fps_in_file( const string &filename ,
                                 DAC_FINGERPRINTS::FP_FILE_FORMAT fp_format ,
                                 const string &bitstring_separator ) {
 
+  // an index has the number in it, an uncompressed binary file only needs
+  // the record lengths stepping over, and a version 2 one has the number in
+  // the header.
+  scoped_ptr<FingerprintIndex> index( FingerprintIndex::open( filename ,
+                                                              fp_format ) );
+  if( index ) {
+    return index->size();
+  }
+  if( MappedFingerprintFile::mappable( filename , fp_format ) ) {
+    MappedFingerprintFile mapped( filename , fp_format );
+    return mapped.size();
+  }
+
   gzFile fpfile;
   bool byteswapping = false;
   open_fp_file_for_reading( filename , fp_format , byteswapping , fpfile );
 
   unsigned int num_fps = 0;
-  while( 1 ) {
-    FingerprintBase *fp = read_next_fp_from_file( fpfile , byteswapping ,
-                                                  fp_format ,
-                                                  bitstring_separator );
-    if( !fp ) {
-      break;
+  {
+    FingerprintBlockReader reader( fpfile , byteswapping , fp_format ,
+                                   bitstring_separator , SCAN_BLOCK_SIZE );
+    while( const FingerprintStore *block = reader.next_block() ) {
+      num_fps += block->size();
     }
-    delete fp;
-    ++num_fps;
   }
+  gzclose( fpfile );
 
   return num_fps;
 
@@ -465,20 +901,39 @@ void get_fp_names( const std::string &filename ,
                    DAC_FINGERPRINTS::FP_FILE_FORMAT fp_format ,
                    const std::string &bitstring_separator ,
                    std::vector<std::string> &fp_names ) {
+
+  scoped_ptr<FingerprintIndex> index( FingerprintIndex::open( filename ,
+                                                              fp_format ) );
+  if( index ) {
+    fp_names.reserve( fp_names.size() + index->size() );
+    for( size_t i = 0 , is = index->size() ; i < is ; ++i ) {
+      fp_names.push_back( index->name( i ) );
+    }
+    return;
+  }
+  if( MappedFingerprintFile::mappable( filename , fp_format ) ) {
+    MappedFingerprintFile mapped( filename , fp_format );
+    FingerprintView fp;
+    while( mapped.next( fp ) ) {
+      fp_names.push_back( fp.name() );
+    }
+    return;
+  }
+
   gzFile fpfile;
   bool byteswapping = false;
   open_fp_file_for_reading( filename , fp_format , byteswapping , fpfile );
 
-  while( 1 ) {
-    FingerprintBase *fp = read_next_fp_from_file( fpfile , byteswapping ,
-                                                  fp_format ,
-                                                  bitstring_separator );
-    if( !fp ) {
-      break;
+  {
+    FingerprintBlockReader reader( fpfile , byteswapping , fp_format ,
+                                   bitstring_separator , SCAN_BLOCK_SIZE );
+    while( const FingerprintStore *block = reader.next_block() ) {
+      for( unsigned int i = 0 , is = block->size() ; i < is ; ++i ) {
+        fp_names.push_back( block->name( i ) );
+      }
     }
-    fp_names.push_back( fp->get_name() );
-    delete fp;
   }
+  gzclose( fpfile );
 
 }
 
@@ -0,0 +1,113 @@
+//
+// file FingerprintBlockReader.cc
+// 16th October 2026
+//
+
+#include "FingerprintBlockReader.H"
+#include "FingerprintStore.H"
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// ****************************************************************************
+FingerprintBlockReader::FingerprintBlockReader( gzFile fp , bool byteswapping ,
+                                                FP_FILE_FORMAT file_format ,
+                                                const string &bitstring_separator ,
+                                                unsigned int block_size ,
+                                                unsigned int num_blocks ) :
+  fp_( fp ) , byteswapping_( byteswapping ) , file_format_( file_format ) ,
+  bitstring_separator_( bitstring_separator ) , block_size_( block_size ) ,
+  next_fill_( 0 ) , next_hand_( 0 ) , num_filled_( 0 ) , held_( false ) ,
+  finished_( false ) , stop_( false ) {
+
+  // one for the caller and at least one for the thread
+  if( num_blocks < 2 ) {
+    num_blocks = 2;
+  }
+  for( unsigned int i = 0 ; i < num_blocks ; ++i ) {
+    blocks_.push_back( new FingerprintStore );
+  }
+
+  thread_ = boost::thread( boost::bind( &FingerprintBlockReader::read_blocks ,
+                                        this ) );
+
+}
+
+// ****************************************************************************
+FingerprintBlockReader::~FingerprintBlockReader() {
+
+  {
+    boost::mutex::scoped_lock lock( mutex_ );
+    stop_ = true;
+    changed_.notify_all();
+  }
+  thread_.join();
+
+  for( unsigned int i = 0 , is = blocks_.size() ; i < is ; ++i ) {
+    delete blocks_[i];
+  }
+
+}
+
+// ****************************************************************************
+const FingerprintStore *FingerprintBlockReader::next_block() {
+
+  boost::mutex::scoped_lock lock( mutex_ );
+  // the last one is finished with, so the thread can have it back
+  held_ = false;
+  changed_.notify_all();
+
+  while( !num_filled_ && !finished_ ) {
+    changed_.wait( lock );
+  }
+  if( !num_filled_ ) {
+    return 0;
+  }
+
+  const FingerprintStore *block = blocks_[next_hand_];
+  next_hand_ = ( next_hand_ + 1 ) % blocks_.size();
+  --num_filled_;
+  held_ = true;
+  return block;
+
+}
+
+// ****************************************************************************
+// the thread.  The block it fills is never one the caller has or is waiting
+// for, so the reading is done without the lock.
+void FingerprintBlockReader::read_blocks() {
+
+  while( 1 ) {
+    FingerprintStore *block = 0;
+    {
+      boost::mutex::scoped_lock lock( mutex_ );
+      while( !stop_ && num_filled_ + ( held_ ? 1 : 0 ) == blocks_.size() ) {
+        changed_.wait( lock );
+      }
+      if( stop_ ) {
+        return;
+      }
+      block = blocks_[next_fill_];
+    }
+
+    block->clear();
+    read_fps_from_file( fp_ , byteswapping_ , file_format_ ,
+                        bitstring_separator_ , 0 , block_size_ , *block );
+
+    boost::mutex::scoped_lock lock( mutex_ );
+    if( block->empty() ) {
+      finished_ = true;
+      changed_.notify_all();
+      return;
+    }
+    next_fill_ = ( next_fill_ + 1 ) % blocks_.size();
+    ++num_filled_;
+    changed_.notify_all();
+  }
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -0,0 +1,842 @@
+//
+// file FingerprintIndex.cc
+// 16th October 2026
+//
+
+#include "FingerprintIndex.H"
+#include "ByteSwapper.H"
+#include "FileExceptions.H"
+#include "FingerprintStore.H"
+#include "HashedFingerprint.H"
+#include "MagicInts.H"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// how much compressed input is read at a time
+static const size_t INFLATE_CHUNK = 65536;
+
+// ****************************************************************************
+// reads the uncompressed contents of a file, gzipped or not, a bit at a
+// time, and for a gzipped one can start again from a checkpoint made by an
+// earlier reading.  The inflating is done by hand rather than with gzread
+// because gzFile doesn't give access to the block boundaries or the window.
+// Output is inflated into a circular buffer the size of the deflate window,
+// so when a checkpoint is taken the buffer is the window it needs.
+// Multi-member gzip files, such as those made by cat or BGZF writers, are
+// followed from one member to the next.
+class InflateReader {
+
+public :
+
+  // throws a DACLIB::FileReadOpenError if the file can't be opened
+  explicit InflateReader( const string &filename );
+  ~InflateReader();
+
+  bool compressed() const { return compressed_; }
+  // the uncompressed offset of the next byte read will return
+  uint64_t out_pos() const { return out_pos_; }
+
+  // carry on from a checkpoint or member start of a compressed file
+  void restart( const IndexCheckpoint &cp );
+  void restart( const IndexMember &member );
+  // go to out in an uncompressed file
+  void seek( uint64_t out );
+
+  // the number of bytes read, which is only less than num_bytes at the end
+  size_t read( void *buf , size_t num_bytes );
+  bool skip( uint64_t num_bytes );
+
+  // while reading a compressed file from the start, write an
+  // IndexCheckpoint to cp_file at the first block boundary after every span
+  // bytes of output.
+  void write_checkpoints( FILE *cp_file , uint64_t span ) {
+    cp_file_ = cp_file;
+    cp_span_ = span;
+  }
+  uint64_t num_checkpoints() const { return num_cps_; }
+  // the starts of the gzip members after the first, so far
+  const vector<IndexMember> &members() const { return members_; }
+
+private :
+
+  string   filename_;
+  FILE     *fp_;
+  bool     compressed_;
+  z_stream strm_;
+  bool     raw_;          // inflating a bare deflate stream from a checkpoint
+  bool     member_start_; // at the start of a gzip member
+  bool     finished_;
+
+  vector<unsigned char> in_;
+  vector<unsigned char> window_;
+  size_t   rd_ , wr_;    // next byte to hand out, and end of output, in window_
+  uint64_t file_pos_;   // of the end of what's in in_
+  uint64_t out_pos_;    // of window_[rd_]
+  uint64_t out_total_;  // of window_[wr_]
+
+  FILE     *cp_file_;
+  uint64_t cp_span_ , last_cp_ , num_cps_;
+  vector<IndexMember> members_;
+
+  bool fill();
+  bool next_member();
+  void take_checkpoint();
+  bool read_input();
+
+  // no copying
+  InflateReader( const InflateReader &ir );
+  InflateReader &operator=( const InflateReader &ir );
+
+};
+
+// ****************************************************************************
+InflateReader::InflateReader( const string &filename ) :
+  filename_( filename ) , fp_( 0 ) , compressed_( false ) , raw_( false ) ,
+  member_start_( true ) , finished_( false ) , in_( INFLATE_CHUNK ) ,
+  window_( FPI_WINDOW_SIZE , 0 ) , rd_( 0 ) , wr_( 0 ) , file_pos_( 0 ) ,
+  out_pos_( 0 ) , out_total_( 0 ) , cp_file_( 0 ) , cp_span_( 0 ) ,
+  last_cp_( 0 ) , num_cps_( 0 ) {
+
+  fp_ = fopen( filename.c_str() , "rb" );
+  if( !fp_ ) {
+    throw DACLIB::FileReadOpenError( filename.c_str() );
+  }
+  int c1 = getc( fp_ );
+  int c2 = getc( fp_ );
+  compressed_ = 0x1f == c1 && 0x8b == c2;
+  fseeko( fp_ , 0 , SEEK_SET );
+
+  memset( &strm_ , 0 , sizeof( strm_ ) );
+  if( compressed_ ) {
+    // 47 is a zlib or gzip header, whichever it turns out to be
+    if( Z_OK != inflateInit2( &strm_ , 47 ) ) {
+      fclose( fp_ );
+      throw DACLIB::FileReadOpenError( filename.c_str() );
+    }
+  }
+
+}
+
+// ****************************************************************************
+InflateReader::~InflateReader() {
+
+  if( compressed_ ) {
+    inflateEnd( &strm_ );
+  }
+  fclose( fp_ );
+
+}
+
+// ****************************************************************************
+void InflateReader::restart( const IndexCheckpoint &cp ) {
+
+  fseeko( fp_ , cp.in_ - ( cp.bits_ ? 1 : 0 ) , SEEK_SET );
+  inflateReset2( &strm_ , -15 );
+  if( cp.bits_ ) {
+    int c = getc( fp_ );
+    inflatePrime( &strm_ , cp.bits_ , c >> ( 8 - cp.bits_ ) );
+  }
+  inflateSetDictionary( &strm_ , cp.window_ , FPI_WINDOW_SIZE );
+  strm_.avail_in = 0;
+  raw_ = true;
+  member_start_ = false;
+  finished_ = false;
+  file_pos_ = cp.in_;
+  rd_ = wr_ = 0;
+  out_pos_ = out_total_ = cp.out_;
+
+}
+
+// ****************************************************************************
+void InflateReader::restart( const IndexMember &member ) {
+
+  fseeko( fp_ , member.in_ , SEEK_SET );
+  inflateReset2( &strm_ , 47 );
+  strm_.avail_in = 0;
+  raw_ = false;
+  member_start_ = true;
+  finished_ = false;
+  file_pos_ = member.in_;
+  rd_ = wr_ = 0;
+  out_pos_ = out_total_ = member.out_;
+
+}
+
+// ****************************************************************************
+void InflateReader::seek( uint64_t out ) {
+
+  fseeko( fp_ , out , SEEK_SET );
+  finished_ = false;
+  rd_ = wr_ = 0;
+  out_pos_ = out_total_ = out;
+
+}
+
+// ****************************************************************************
+bool InflateReader::read_input() {
+
+  size_t num_read = fread( &in_[0] , 1 , in_.size() , fp_ );
+  file_pos_ += num_read;
+  strm_.next_in = &in_[0];
+  strm_.avail_in = num_read;
+  return num_read > 0;
+
+}
+
+// ****************************************************************************
+// at the end of a gzip member, which might be followed by another one.
+// False if it isn't.
+bool InflateReader::next_member() {
+
+  if( raw_ ) {
+    // inflating raw leaves the member's 8-byte trailer to be stepped over
+    for( int i = 0 ; i < 8 ; ++i ) {
+      if( !strm_.avail_in && !read_input() ) {
+        return false;
+      }
+      ++strm_.next_in;
+      --strm_.avail_in;
+    }
+    raw_ = false;
+  }
+  if( !strm_.avail_in && !read_input() ) {
+    return false;
+  }
+  inflateReset2( &strm_ , 47 );
+  member_start_ = true;
+  IndexMember member;
+  member.out_ = out_total_;
+  member.in_ = file_pos_ - strm_.avail_in;
+  members_.push_back( member );
+  // which is as good as a checkpoint
+  last_cp_ = out_total_;
+  return true;
+
+}
+
+// ****************************************************************************
+void InflateReader::take_checkpoint() {
+
+  IndexCheckpoint cp;
+  memset( &cp , 0 , sizeof( cp ) );
+  cp.out_ = out_total_;
+  cp.in_ = file_pos_ - strm_.avail_in;
+  cp.bits_ = strm_.data_type & 7;
+  // the window is circular, with the oldest byte at wr_
+  size_t num_old = FPI_WINDOW_SIZE - wr_;
+  memcpy( cp.window_ , &window_[wr_] , num_old );
+  memcpy( cp.window_ + num_old , &window_[0] , wr_ );
+  if( 1 != fwrite( &cp , sizeof( cp ) , 1 , cp_file_ ) ) {
+    cerr << "Error writing checkpoint for " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  last_cp_ = out_total_;
+  ++num_cps_;
+
+}
+
+// ****************************************************************************
+// put more output into window_.  Only called when everything already there
+// has been handed out.  False at the end of the file.
+bool InflateReader::fill() {
+
+  if( finished_ ) {
+    return false;
+  }
+
+  if( !compressed_ ) {
+    rd_ = 0;
+    wr_ = fread( &window_[0] , 1 , window_.size() , fp_ );
+    out_total_ += wr_;
+    finished_ = !wr_;
+    return wr_ > 0;
+  }
+
+  if( FPI_WINDOW_SIZE == wr_ ) {
+    rd_ = wr_ = 0;
+  }
+  while( 1 ) {
+    if( !strm_.avail_in && !read_input() ) {
+      // the file stops without the end of the stream, so it's truncated,
+      // which is taken to be the end as gzread would.
+      finished_ = true;
+      return false;
+    }
+    strm_.next_out = &window_[wr_];
+    strm_.avail_out = FPI_WINDOW_SIZE - wr_;
+    int ret = inflate( &strm_ , Z_BLOCK );
+    size_t num_out = FPI_WINDOW_SIZE - wr_ - strm_.avail_out;
+    wr_ += num_out;
+    out_total_ += num_out;
+    if( Z_DATA_ERROR == ret && member_start_ && !num_out ) {
+      // rubbish after the last member, which gzread ignores as well
+      finished_ = true;
+      return false;
+    }
+    if( Z_OK != ret && Z_STREAM_END != ret && Z_BUF_ERROR != ret ) {
+      cerr << "Error : " << filename_ << " isn't valid gzip data." << endl;
+      exit( 1 );
+    }
+    if( num_out ) {
+      member_start_ = false;
+    }
+    // data_type has bit 7 set at the end of a block header, and bit 6 if
+    // it's the last block of the stream
+    if( cp_file_ && ( strm_.data_type & 128 ) && !( strm_.data_type & 64 )
+        && out_total_ - last_cp_ >= cp_span_ ) {
+      take_checkpoint();
+    }
+    if( Z_STREAM_END == ret && !next_member() ) {
+      finished_ = true;
+      return wr_ > rd_;
+    }
+    if( wr_ > rd_ ) {
+      return true;
+    }
+  }
+
+}
+
+// ****************************************************************************
+size_t InflateReader::read( void *buf , size_t num_bytes ) {
+
+  unsigned char *out = static_cast<unsigned char *>( buf );
+  size_t num_read = 0;
+  while( num_read < num_bytes ) {
+    if( rd_ == wr_ && !fill() ) {
+      break;
+    }
+    size_t n = min( num_bytes - num_read , wr_ - rd_ );
+    memcpy( out + num_read , &window_[rd_] , n );
+    rd_ += n;
+    num_read += n;
+  }
+  out_pos_ += num_read;
+  return num_read;
+
+}
+
+// ****************************************************************************
+bool InflateReader::skip( uint64_t num_bytes ) {
+
+  while( num_bytes ) {
+    if( rd_ == wr_ && !fill() ) {
+      return false;
+    }
+    size_t n = min( num_bytes , uint64_t( wr_ - rd_ ) );
+    rd_ += n;
+    out_pos_ += n;
+    num_bytes -= n;
+  }
+  return true;
+
+}
+
+// ****************************************************************************
+static int num_ints_from_chars( int num_chars ) {
+
+  int num_ints = num_chars / sizeof( unsigned int );
+  if( num_chars % sizeof( unsigned int ) ) {
+    ++num_ints;
+  }
+  return num_ints;
+
+}
+
+// ****************************************************************************
+static void truncated_file( const string &fp_file ) {
+
+  cerr << "Error : " << fp_file << " is truncated." << endl;
+  exit( 1 );
+
+}
+
+// ****************************************************************************
+// the next record of a version 1 flush file, with num_ints ints of bits, or
+// binary fragment number file.  The numbers are byteswapped, or not, as
+// StoreReadSpace does it.  False at the end of the file.
+static bool read_record( InflateReader &in , const string &fp_file ,
+                         FP_FILE_FORMAT format , bool byteswapping ,
+                         unsigned int num_ints , string &name ,
+                         vector<uint32_t> &nums ) {
+
+  int name_len;
+  size_t num_read = in.read( &name_len , sizeof( name_len ) );
+  if( !num_read ) {
+    return false;
+  }
+  if( byteswapping ) {
+    DACLIB::byte_swapper<int>( name_len );
+  }
+  if( sizeof( name_len ) != num_read || name_len < 0 ) {
+    truncated_file( fp_file );
+  }
+  name.resize( name_len );
+  if( name_len && size_t( name_len ) != in.read( &name[0] , name_len ) ) {
+    truncated_file( fp_file );
+  }
+
+  int num_nums = num_ints;
+  if( BIN_FRAG_NUMS == format ) {
+    if( sizeof( num_nums ) != in.read( &num_nums , sizeof( num_nums ) ) ) {
+      truncated_file( fp_file );
+    }
+    if( byteswapping ) {
+      DACLIB::byte_swapper<int>( num_nums );
+    }
+    if( num_nums < 0 ) {
+      truncated_file( fp_file );
+    }
+  }
+  nums.resize( num_nums );
+  size_t num_bytes = num_nums * sizeof( uint32_t );
+  if( num_nums && num_bytes != in.read( &nums[0] , num_bytes ) ) {
+    truncated_file( fp_file );
+  }
+  return true;
+
+}
+
+// ****************************************************************************
+uint64_t fp_name_hash( const char *name , size_t name_len ) {
+
+  uint64_t hash = 14695981039346656037ULL;
+  for( size_t i = 0 ; i < name_len ; ++i ) {
+    hash ^= static_cast<unsigned char>( name[i] );
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+
+}
+
+// ****************************************************************************
+class SortNameHashes {
+public :
+  bool operator()( const IndexNameHash &a , const IndexNameHash &b ) const {
+    if( a.hash_ != b.hash_ ) {
+      return a.hash_ < b.hash_;
+    }
+    return a.fp_num_ < b.fp_num_;
+  }
+};
+
+// ****************************************************************************
+static bool file_size_and_time( const string &filename , uint64_t &size ,
+                                uint64_t &mtime ) {
+
+  struct stat st;
+  if( stat( filename.c_str() , &st ) ) {
+    return false;
+  }
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+
+}
+
+// ****************************************************************************
+template <typename T>
+static void write_section( FILE *fp , const string &filename ,
+                           const vector<T> &vals ) {
+
+  if( !vals.empty()
+      && 1 != fwrite( &vals[0] , vals.size() * sizeof( T ) , 1 , fp ) ) {
+    cerr << "Error writing " << filename << "." << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+FingerprintIndexWriter::FingerprintIndexWriter( const string &fp_file ,
+                                                FP_FILE_FORMAT format ,
+                                                int num_chars ,
+                                                bool compressed ,
+                                                bool byteswapping ,
+                                                size_t record_interval ) :
+  idx_file_( FingerprintIndex::index_file( fp_file ) ) , fp_file_( fp_file ) ,
+  fp_( 0 ) , name_starts_( 1 , 0 ) {
+
+  memset( &header_ , 0 , sizeof( header_ ) );
+  header_.magic_ = FPI_MAGIC_INT;
+  header_.version_ = FPI_VERSION;
+  header_.format_ = format;
+  header_.compressed_ = compressed;
+  header_.byteswapping_ = byteswapping;
+  header_.num_chars_ = FLUSH_FPS == format ? num_chars : 0;
+  header_.record_interval_ = record_interval ? record_interval : 1;
+
+  fp_ = fopen( idx_file_.c_str() , "wb" );
+  if( !fp_ ) {
+    throw DACLIB::FileWriteOpenError( idx_file_.c_str() );
+  }
+  // the header goes in properly at the end
+  write_section( fp_ , idx_file_ , vector<char>( sizeof( header_ ) , 0 ) );
+  header_.checkpoints_start_ = sizeof( header_ );
+
+}
+
+// ****************************************************************************
+FingerprintIndexWriter::~FingerprintIndexWriter() {
+
+  if( fp_ ) {
+    fclose( fp_ );
+    remove( idx_file_.c_str() );
+  }
+
+}
+
+// ****************************************************************************
+void FingerprintIndexWriter::add_fp( uint64_t start , const string &name ,
+                                     unsigned int num_bits_set ) {
+
+  if( !( counts_.size() % header_.record_interval_ ) ) {
+    record_starts_.push_back( start );
+  }
+  counts_.push_back( num_bits_set );
+  IndexNameHash nh;
+  nh.hash_ = fp_name_hash( name.data() , name.size() );
+  nh.fp_num_ = name_hashes_.size();
+  name_hashes_.push_back( nh );
+  names_.insert( names_.end() , name.begin() , name.end() );
+  name_starts_.push_back( names_.size() );
+
+}
+
+// ****************************************************************************
+void FingerprintIndexWriter::add_member( uint64_t out , uint64_t in ) {
+
+  IndexMember member;
+  member.out_ = out;
+  member.in_ = in;
+  members_.push_back( member );
+
+}
+
+// ****************************************************************************
+size_t FingerprintIndexWriter::finish( uint64_t num_checkpoints ) {
+
+  if( !file_size_and_time( fp_file_ , header_.file_size_ ,
+                           header_.file_mtime_ ) ) {
+    cerr << "Error : couldn't find the size of " << fp_file_ << "." << endl;
+    exit( 1 );
+  }
+  sort( name_hashes_.begin() , name_hashes_.end() , SortNameHashes() );
+
+  header_.num_fps_ = counts_.size();
+  header_.num_checkpoints_ = num_checkpoints;
+  header_.num_members_ = members_.size();
+  header_.members_start_ = header_.checkpoints_start_
+      + header_.num_checkpoints_ * sizeof( IndexCheckpoint );
+  write_section( fp_ , idx_file_ , members_ );
+  header_.record_starts_start_ = header_.members_start_
+      + members_.size() * sizeof( IndexMember );
+  write_section( fp_ , idx_file_ , record_starts_ );
+  header_.name_starts_start_ = header_.record_starts_start_
+      + record_starts_.size() * sizeof( uint64_t );
+  write_section( fp_ , idx_file_ , name_starts_ );
+  header_.name_hashes_start_ = header_.name_starts_start_
+      + name_starts_.size() * sizeof( uint64_t );
+  write_section( fp_ , idx_file_ , name_hashes_ );
+  header_.counts_start_ = header_.name_hashes_start_
+      + name_hashes_.size() * sizeof( IndexNameHash );
+  write_section( fp_ , idx_file_ , counts_ );
+  header_.names_start_ = header_.counts_start_
+      + counts_.size() * sizeof( uint32_t );
+  write_section( fp_ , idx_file_ , names_ );
+
+  if( fseeko( fp_ , 0 , SEEK_SET )
+      || 1 != fwrite( &header_ , sizeof( header_ ) , 1 , fp_ )
+      || fclose( fp_ ) ) {
+    cerr << "Error writing " << idx_file_ << "." << endl;
+    exit( 1 );
+  }
+  fp_ = 0;
+
+  return header_.num_fps_;
+
+}
+
+// ****************************************************************************
+size_t build_fp_index( const string &fp_file , FP_FILE_FORMAT format ,
+                       size_t record_interval , size_t checkpoint_span ) {
+
+  // make sure it's there before starting, so a missing file gives the
+  // right error.  The size and time that go in the index are taken at the
+  // end.
+  uint64_t file_size , file_mtime;
+  if( !file_size_and_time( fp_file , file_size , file_mtime ) ) {
+    throw DACLIB::FileReadOpenError( fp_file.c_str() );
+  }
+
+  InflateReader in( fp_file );
+
+  unsigned int magic = 0;
+  in.read( &magic , sizeof( magic ) );
+  unsigned int want = FLUSH_FPS == format ? FP_MAGIC_INT : FN_MAGIC_INT;
+  unsigned int buggered = FLUSH_FPS == format ? BUGGERED_FP_MAGIC_INT :
+                                                BUGGERED_FN_MAGIC_INT;
+  if( want != magic && buggered != magic ) {
+    string apparent = "different";
+    if( FP2_MAGIC_INT == magic || BUGGERED_FP2_MAGIC_INT == magic ) {
+      apparent = "version 2 Flush Fingerprints";
+    } else if( FP_MAGIC_INT == magic || BUGGERED_FP_MAGIC_INT == magic ) {
+      apparent = "Flush Fingerprints";
+    } else if( FN_MAGIC_INT == magic || BUGGERED_FN_MAGIC_INT == magic ) {
+      apparent = "Binary Fragment Numbers";
+    }
+    throw FingerprintFileError( fp_file , format , apparent );
+  }
+  bool byteswapping = buggered == magic;
+  int num_chars = 0;
+  if( FLUSH_FPS == format ) {
+    in.read( &num_chars , sizeof( num_chars ) );
+    if( byteswapping ) {
+      DACLIB::byte_swapper<int>( num_chars );
+    }
+  }
+  unsigned int num_ints = num_ints_from_chars( num_chars );
+
+  FingerprintIndexWriter idx( fp_file , format , num_chars , in.compressed() ,
+                              byteswapping , record_interval );
+  if( in.compressed() ) {
+    in.write_checkpoints( idx.checkpoint_file() , checkpoint_span );
+  }
+
+  string name;
+  vector<uint32_t> nums;
+  while( 1 ) {
+    uint64_t record_start = in.out_pos();
+    if( !read_record( in , fp_file , format , byteswapping , num_ints , name ,
+                      nums ) ) {
+      break;
+    }
+    if( FLUSH_FPS == format ) {
+      idx.add_fp( record_start , name ,
+                  num_ints ? count_bits_set( &nums[0] , num_ints ) : 0 );
+    } else {
+      idx.add_fp( record_start , name , nums.size() );
+    }
+  }
+  for( size_t i = 0 , is = in.members().size() ; i < is ; ++i ) {
+    idx.add_member( in.members()[i].out_ , in.members()[i].in_ );
+  }
+
+  return idx.finish( in.num_checkpoints() );
+
+}
+
+// ****************************************************************************
+FingerprintIndex *FingerprintIndex::open( const string &fp_file ,
+                                          FP_FILE_FORMAT format ) {
+
+  if( FLUSH_FPS != format && BIN_FRAG_NUMS != format ) {
+    return 0;
+  }
+  string idx_file = index_file( fp_file );
+  int fd = ::open( idx_file.c_str() , O_RDONLY );
+  if( fd < 0 ) {
+    return 0;
+  }
+  struct stat st;
+  if( fstat( fd , &st ) || size_t( st.st_size ) < sizeof( FingerprintIndexHeader ) ) {
+    close( fd );
+    return 0;
+  }
+  size_t size = st.st_size;
+  void *data = mmap( 0 , size , PROT_READ , MAP_PRIVATE , fd , 0 );
+  close( fd );
+  if( MAP_FAILED == data ) {
+    return 0;
+  }
+
+  FingerprintIndexHeader header;
+  memcpy( &header , data , sizeof( header ) );
+  uint64_t n = header.num_fps_;
+  uint64_t num_starts = header.record_interval_ ?
+      ( n + header.record_interval_ - 1 ) / header.record_interval_ : 0;
+  bool ok = FPI_MAGIC_INT == header.magic_ && FPI_VERSION == header.version_
+      && uint32_t( format ) == header.format_ && header.record_interval_
+      && header.checkpoints_start_ <= size && header.members_start_ <= size
+      && header.record_starts_start_ <= size
+      && header.name_starts_start_ <= size && header.name_hashes_start_ <= size
+      && header.counts_start_ <= size && header.names_start_ <= size
+      && header.num_checkpoints_ <= ( size - header.checkpoints_start_ ) / sizeof( IndexCheckpoint )
+      && n <= ( size - header.counts_start_ ) / sizeof( uint32_t )
+      && header.num_members_ <= ( size - header.members_start_ ) / sizeof( IndexMember )
+      && header.checkpoints_start_ + header.num_checkpoints_ * sizeof( IndexCheckpoint ) <= header.members_start_
+      && header.members_start_ + header.num_members_ * sizeof( IndexMember ) <= header.record_starts_start_
+      && header.record_starts_start_ + num_starts * sizeof( uint64_t ) <= header.name_starts_start_
+      && header.name_starts_start_ + ( n + 1 ) * sizeof( uint64_t ) <= header.name_hashes_start_
+      && header.name_hashes_start_ + n * sizeof( IndexNameHash ) <= header.counts_start_
+      && header.counts_start_ + n * sizeof( uint32_t ) <= header.names_start_;
+  if( ok ) {
+    const uint64_t *name_starts = reinterpret_cast<const uint64_t *>( static_cast<const char *>( data ) + header.name_starts_start_ );
+    ok = name_starts[n] <= size - header.names_start_;
+  }
+  if( !ok ) {
+    cerr << "Warning : " << idx_file << " isn't a usable index for "
+         << fp_file << ", so it's being ignored." << endl;
+    munmap( data , size );
+    return 0;
+  }
+
+  uint64_t file_size , file_mtime;
+  if( !file_size_and_time( fp_file , file_size , file_mtime )
+      || file_size != header.file_size_ || file_mtime != header.file_mtime_ ) {
+    cerr << "Warning : " << idx_file << " is out of date, so it's being"
+         << " ignored.  Run index_fp_file on " << fp_file << " again." << endl;
+    munmap( data , size );
+    return 0;
+  }
+
+  return new FingerprintIndex( fp_file , static_cast<const char *>( data ) ,
+                               size );
+
+}
+
+// ****************************************************************************
+FingerprintIndex::FingerprintIndex( const string &fp_file , const char *data ,
+                                    size_t size ) :
+  fp_file_( fp_file ) , data_( data ) , size_( size ) {
+
+  memcpy( &header_ , data_ , sizeof( header_ ) );
+  checkpoints_ = reinterpret_cast<const IndexCheckpoint *>( data_ + header_.checkpoints_start_ );
+  members_ = reinterpret_cast<const IndexMember *>( data_ + header_.members_start_ );
+  record_starts_ = reinterpret_cast<const uint64_t *>( data_ + header_.record_starts_start_ );
+  name_starts_ = reinterpret_cast<const uint64_t *>( data_ + header_.name_starts_start_ );
+  name_hashes_ = reinterpret_cast<const IndexNameHash *>( data_ + header_.name_hashes_start_ );
+  counts_ = reinterpret_cast<const uint32_t *>( data_ + header_.counts_start_ );
+  names_ = data_ + header_.names_start_;
+
+}
+
+// ****************************************************************************
+FingerprintIndex::~FingerprintIndex() {
+
+  munmap( const_cast<char *>( data_ ) , size_ );
+
+}
+
+// ****************************************************************************
+string FingerprintIndex::name( size_t i ) const {
+
+  return string( names_ + name_starts_[i] , name_starts_[i + 1] - name_starts_[i] );
+
+}
+
+// ****************************************************************************
+void FingerprintIndex::find( const string &name ,
+                             vector<size_t> &fp_nums ) const {
+
+  IndexNameHash lo , hi;
+  lo.hash_ = hi.hash_ = fp_name_hash( name.data() , name.size() );
+  lo.fp_num_ = 0;
+  hi.fp_num_ = header_.num_fps_;
+  const IndexNameHash *first = lower_bound( name_hashes_ ,
+                                            name_hashes_ + header_.num_fps_ ,
+                                            lo , SortNameHashes() );
+  const IndexNameHash *last = upper_bound( first ,
+                                           name_hashes_ + header_.num_fps_ ,
+                                           hi , SortNameHashes() );
+  // they're in fp_num order within a hash, so file order
+  for( ; first != last ; ++first ) {
+    size_t i = first->fp_num_;
+    if( name.size() == name_starts_[i + 1] - name_starts_[i]
+        && !memcmp( name.data() , names_ + name_starts_[i] , name.size() ) ) {
+      fp_nums.push_back( i );
+    }
+  }
+
+}
+
+// ****************************************************************************
+// for finding the last checkpoint or member start at or before an offset
+template <typename T>
+class StartsAfter {
+public :
+  bool operator()( uint64_t out , const T &start ) const {
+    return out < start.out_;
+  }
+};
+
+// ****************************************************************************
+void FingerprintIndex::read_fps( size_t first_fp , size_t num_fps ,
+                                 FingerprintStore &fps ) const {
+
+  if( first_fp >= header_.num_fps_ ) {
+    return;
+  }
+  num_fps = min( num_fps , size_t( header_.num_fps_ - first_fp ) );
+  unsigned int num_ints = 0;
+  if( FLUSH_FPS == header_.format_ ) {
+    num_ints = num_ints_from_chars( header_.num_chars_ );
+    // only if it's changing, as there may be other threads reading
+    if( HashedFingerprint::num_ints() != num_ints ) {
+      HashedFingerprint::set_num_ints( num_ints );
+    }
+    fps.reserve( fps.size() + num_fps );
+  }
+
+  // the nearest record start, then the nearest checkpoint or member start
+  // before that
+  size_t start_num = first_fp / header_.record_interval_;
+  uint64_t record_start = record_starts_[start_num];
+  InflateReader in( fp_file_ );
+  if( in.compressed() ) {
+    const IndexCheckpoint *cp = upper_bound( checkpoints_ ,
+                                             checkpoints_ + header_.num_checkpoints_ ,
+                                             record_start ,
+                                             StartsAfter<IndexCheckpoint>() );
+    const IndexMember *member = upper_bound( members_ ,
+                                             members_ + header_.num_members_ ,
+                                             record_start ,
+                                             StartsAfter<IndexMember>() );
+    if( member != members_
+        && ( cp == checkpoints_ || ( member - 1 )->out_ >= ( cp - 1 )->out_ ) ) {
+      in.restart( *( member - 1 ) );
+    } else if( cp != checkpoints_ ) {
+      in.restart( *( cp - 1 ) );
+    }
+    in.skip( record_start - in.out_pos() );
+  } else {
+    in.seek( record_start );
+  }
+
+  FP_FILE_FORMAT format = FP_FILE_FORMAT( header_.format_ );
+  string name;
+  vector<uint32_t> nums;
+  for( size_t i = start_num * header_.record_interval_ ; i < first_fp ; ++i ) {
+    read_record( in , fp_file_ , format , header_.byteswapping_ , num_ints ,
+                 name , nums );
+  }
+  for( size_t i = 0 ; i < num_fps ; ++i ) {
+    if( !read_record( in , fp_file_ , format , header_.byteswapping_ ,
+                      num_ints , name , nums ) ) {
+      truncated_file( fp_file_ );
+    }
+    if( FLUSH_FPS == format ) {
+      fps.add_hashed( name , &nums[0] );
+    } else {
+      fps.add_not_hashed( name , nums.empty() ? 0 : &nums[0] , nums.size() );
+    }
+  }
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
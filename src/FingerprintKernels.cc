@@ -0,0 +1,1056 @@
+//
+// file FingerprintKernels.cc
+// 16th October 2026
+//
+// The popcount and intersection kernels and the code that decides which ones
+// to use.
+// The SIMD flavours are compiled with gcc's target attribute rather than
+// -m flags on the command line, so the rest of the program stays plain
+// x86-64 and the fancy instructions are only executed if
+// __builtin_cpu_supports says they're there.
+// The AVX2 counting is the Harley-Seal carry-save adder scheme with Mula's
+// PSHUFB nibble lookup for the final counts, from
+// Mula W, Kurz N, Lemire D, "Faster Population Counts Using AVX2
+// Instructions", Computer Journal 2018 (arXiv:1611.07612).
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "FingerprintKernels.H"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define DAC_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// target attributes on templates and the AVX2 intrinsics outside -mavx2 need
+// gcc 4.9, AVX-512 VPOPCNTDQ and the corresponding __builtin_cpu_supports
+// test need gcc 8.
+#if defined(DAC_X86_KERNELS) && ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) )
+#define DAC_AVX2_KERNELS 1
+#endif
+#if defined(DAC_X86_KERNELS) && __GNUC__ >= 8
+#define DAC_AVX512_KERNELS 1
+#endif
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// ****************************************************************************
+// The operations the kernels can do on a pair of words before counting.
+// Each has a scalar version and, where relevant, vector ones.  a is always
+// the first array, b the second, which is ignored by OpNone.
+struct OpNone {
+  static uint64_t op( uint64_t a , uint64_t b __attribute__((unused)) ) { return a; }
+};
+struct OpAnd {
+  static uint64_t op( uint64_t a , uint64_t b ) { return a & b; }
+};
+struct OpAndNot {
+  static uint64_t op( uint64_t a , uint64_t b ) { return a & ~b; }
+};
+
+// ****************************************************************************
+// unaligned 64-bit load that's safe whatever the compiler thinks of aliasing.
+static inline uint64_t load_word( const uint64_t *p ) {
+  uint64_t w;
+  memcpy( &w , p , sizeof( w ) );
+  return w;
+}
+
+// ****************************************************************************
+// the plain C++ version, the classic SWAR count.
+static inline int swar_popcount( uint64_t x ) {
+
+  x = x - ( ( x >> 1 ) & 0x5555555555555555ULL );
+  x = ( x & 0x3333333333333333ULL ) + ( ( x >> 2 ) & 0x3333333333333333ULL );
+  x = ( x + ( x >> 4 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+  return int( ( x * 0x0101010101010101ULL ) >> 56 );
+
+}
+
+// ****************************************************************************
+template <class Op , int NW>
+static inline int generic_count( const uint64_t *a , const uint64_t *b ,
+                                 int num_words ) {
+
+  const int n = NW ? NW : num_words;
+  int cnt = 0;
+  for( int i = 0 ; i < n ; ++i ) {
+    cnt += swar_popcount( Op::op( load_word( a + i ) ,
+                                  b ? load_word( b + i ) : 0 ) );
+  }
+  return cnt;
+
+}
+
+// ****************************************************************************
+// the entry points.  If the width is the one the template was instantiated
+// for, the loops have fixed trip counts and are unrolled by the compiler.
+template <int NW>
+static int generic_popcount( const uint64_t *a , int num_words ) {
+  if( NW == num_words ) {
+    return generic_count<OpNone , NW>( a , 0 , NW );
+  }
+  return generic_count<OpNone , 0>( a , 0 , num_words );
+}
+template <int NW>
+static int generic_popcount_and( const uint64_t *a , const uint64_t *b ,
+                                 int num_words ) {
+  if( NW == num_words ) {
+    return generic_count<OpAnd , NW>( a , b , NW );
+  }
+  return generic_count<OpAnd , 0>( a , b , num_words );
+}
+template <int NW>
+static int generic_popcount_andnot( const uint64_t *a , const uint64_t *b ,
+                                    int num_words ) {
+  if( NW == num_words ) {
+    return generic_count<OpAndNot , NW>( a , b , NW );
+  }
+  return generic_count<OpAndNot , 0>( a , b , num_words );
+}
+
+// ****************************************************************************
+template <int NW>
+static PopcountKernels generic_kernels() {
+  PopcountKernels k = { "GENERIC" , &generic_popcount<NW> ,
+                        &generic_popcount_and<NW> ,
+                        &generic_popcount_andnot<NW> };
+  return k;
+}
+
+#ifdef DAC_X86_KERNELS
+// ****************************************************************************
+// hardware POPCNT, 4 independent accumulators to keep the pipes busy.
+template <class Op , int NW>
+__attribute__((target("popcnt")))
+static inline int popcnt_count( const uint64_t *a , const uint64_t *b ,
+                                int num_words ) {
+
+  const int n = NW ? NW : num_words;
+  uint64_t c0 = 0 , c1 = 0 , c2 = 0 , c3 = 0;
+  int i = 0;
+  for( ; i + 4 <= n ; i += 4 ) {
+    c0 += __builtin_popcountll( Op::op( load_word( a + i ) , b ? load_word( b + i ) : 0 ) );
+    c1 += __builtin_popcountll( Op::op( load_word( a + i + 1 ) , b ? load_word( b + i + 1 ) : 0 ) );
+    c2 += __builtin_popcountll( Op::op( load_word( a + i + 2 ) , b ? load_word( b + i + 2 ) : 0 ) );
+    c3 += __builtin_popcountll( Op::op( load_word( a + i + 3 ) , b ? load_word( b + i + 3 ) : 0 ) );
+  }
+  for( ; i < n ; ++i ) {
+    c0 += __builtin_popcountll( Op::op( load_word( a + i ) , b ? load_word( b + i ) : 0 ) );
+  }
+  return int( c0 + c1 + c2 + c3 );
+
+}
+
+// ****************************************************************************
+template <int NW>
+__attribute__((target("popcnt")))
+static int popcnt_popcount( const uint64_t *a , int num_words ) {
+  if( NW == num_words ) {
+    return popcnt_count<OpNone , NW>( a , 0 , NW );
+  }
+  return popcnt_count<OpNone , 0>( a , 0 , num_words );
+}
+template <int NW>
+__attribute__((target("popcnt")))
+static int popcnt_popcount_and( const uint64_t *a , const uint64_t *b ,
+                                int num_words ) {
+  if( NW == num_words ) {
+    return popcnt_count<OpAnd , NW>( a , b , NW );
+  }
+  return popcnt_count<OpAnd , 0>( a , b , num_words );
+}
+template <int NW>
+__attribute__((target("popcnt")))
+static int popcnt_popcount_andnot( const uint64_t *a , const uint64_t *b ,
+                                   int num_words ) {
+  if( NW == num_words ) {
+    return popcnt_count<OpAndNot , NW>( a , b , NW );
+  }
+  return popcnt_count<OpAndNot , 0>( a , b , num_words );
+}
+
+// ****************************************************************************
+template <int NW>
+static PopcountKernels popcnt_kernels() {
+  PopcountKernels k = { "POPCNT" , &popcnt_popcount<NW> ,
+                        &popcnt_popcount_and<NW> ,
+                        &popcnt_popcount_andnot<NW> };
+  return k;
+}
+#endif
+
+#ifdef DAC_AVX2_KERNELS
+// ****************************************************************************
+// the vector versions of the ops for AVX2.
+struct Avx2None {
+  __attribute__((target("avx2")))
+  static __m256i load( const uint64_t *a , const uint64_t *b __attribute__((unused)) ) {
+    return _mm256_loadu_si256( reinterpret_cast<const __m256i *>( a ) );
+  }
+  typedef OpNone Scalar;
+};
+struct Avx2And {
+  __attribute__((target("avx2")))
+  static __m256i load( const uint64_t *a , const uint64_t *b ) {
+    return _mm256_and_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i *>( a ) ) ,
+                             _mm256_loadu_si256( reinterpret_cast<const __m256i *>( b ) ) );
+  }
+  typedef OpAnd Scalar;
+};
+struct Avx2AndNot {
+  __attribute__((target("avx2")))
+  static __m256i load( const uint64_t *a , const uint64_t *b ) {
+    // _mm256_andnot_si256 does ~first & second
+    return _mm256_andnot_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i *>( b ) ) ,
+                                _mm256_loadu_si256( reinterpret_cast<const __m256i *>( a ) ) );
+  }
+  typedef OpAndNot Scalar;
+};
+
+// ****************************************************************************
+// bit count of each byte by PSHUFB nibble lookup, summed into 4 64-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i avx2_popcount_vec( __m256i v ) {
+
+  const __m256i lookup = _mm256_setr_epi8( 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+                                           1 , 2 , 2 , 3 , 2 , 3 , 3 , 4 ,
+                                           0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+                                           1 , 2 , 2 , 3 , 2 , 3 , 3 , 4 );
+  const __m256i low_mask = _mm256_set1_epi8( 0x0f );
+  __m256i lo = _mm256_and_si256( v , low_mask );
+  __m256i hi = _mm256_and_si256( _mm256_srli_epi16( v , 4 ) , low_mask );
+  __m256i cnt = _mm256_add_epi8( _mm256_shuffle_epi8( lookup , lo ) ,
+                                 _mm256_shuffle_epi8( lookup , hi ) );
+  return _mm256_sad_epu8( cnt , _mm256_setzero_si256() );
+
+}
+
+// ****************************************************************************
+// carry-save adder: h:l = a + b + c
+__attribute__((target("avx2")))
+static inline void avx2_csa( __m256i &h , __m256i &l , __m256i a , __m256i b ,
+                             __m256i c ) {
+
+  __m256i u = _mm256_xor_si256( a , b );
+  h = _mm256_or_si256( _mm256_and_si256( a , b ) , _mm256_and_si256( u , c ) );
+  l = _mm256_xor_si256( u , c );
+
+}
+
+// ****************************************************************************
+// Harley-Seal over blocks of 8 vectors (2048 bits), then single vectors, then
+// single words for what's left.
+template <class Op , int NW>
+__attribute__((target("avx2,popcnt")))
+static inline int avx2_count( const uint64_t *a , const uint64_t *b ,
+                              int num_words ) {
+
+  const int n = NW ? NW : num_words;
+  const int num_vecs = n / 4;
+  __m256i total = _mm256_setzero_si256();
+  __m256i ones = _mm256_setzero_si256() , twos = _mm256_setzero_si256();
+  __m256i fours = _mm256_setzero_si256() , eights;
+  __m256i twos_a , twos_b , fours_a , fours_b;
+
+  const int num_hs_vecs = num_vecs - num_vecs % 8;
+  for( int i = 0 ; i < num_hs_vecs ; i += 8 ) {
+    const uint64_t *pa = a + 4 * i , *pb = b ? b + 4 * i : 0;
+    avx2_csa( twos_a , ones , ones , Op::load( pa , pb ) ,
+              Op::load( pa + 4 , pb ? pb + 4 : 0 ) );
+    avx2_csa( twos_b , ones , ones , Op::load( pa + 8 , pb ? pb + 8 : 0 ) ,
+              Op::load( pa + 12 , pb ? pb + 12 : 0 ) );
+    avx2_csa( fours_a , twos , twos , twos_a , twos_b );
+    avx2_csa( twos_a , ones , ones , Op::load( pa + 16 , pb ? pb + 16 : 0 ) ,
+              Op::load( pa + 20 , pb ? pb + 20 : 0 ) );
+    avx2_csa( twos_b , ones , ones , Op::load( pa + 24 , pb ? pb + 24 : 0 ) ,
+              Op::load( pa + 28 , pb ? pb + 28 : 0 ) );
+    avx2_csa( fours_b , twos , twos , twos_a , twos_b );
+    avx2_csa( eights , fours , fours , fours_a , fours_b );
+    total = _mm256_add_epi64( total , avx2_popcount_vec( eights ) );
+  }
+  total = _mm256_slli_epi64( total , 3 );
+  total = _mm256_add_epi64( total , _mm256_slli_epi64( avx2_popcount_vec( fours ) , 2 ) );
+  total = _mm256_add_epi64( total , _mm256_slli_epi64( avx2_popcount_vec( twos ) , 1 ) );
+  total = _mm256_add_epi64( total , avx2_popcount_vec( ones ) );
+
+  for( int i = num_hs_vecs ; i < num_vecs ; ++i ) {
+    total = _mm256_add_epi64( total ,
+                              avx2_popcount_vec( Op::load( a + 4 * i ,
+                                                           b ? b + 4 * i : 0 ) ) );
+  }
+
+  uint64_t lanes[4];
+  _mm256_storeu_si256( reinterpret_cast<__m256i *>( lanes ) , total );
+  uint64_t cnt = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for( int j = 4 * num_vecs ; j < n ; ++j ) {
+    cnt += __builtin_popcountll( Op::Scalar::op( load_word( a + j ) ,
+                                                 b ? load_word( b + j ) : 0 ) );
+  }
+  return int( cnt );
+
+}
+
+// ****************************************************************************
+template <int NW>
+__attribute__((target("avx2,popcnt")))
+static int avx2_popcount( const uint64_t *a , int num_words ) {
+  if( NW == num_words ) {
+    return avx2_count<Avx2None , NW>( a , 0 , NW );
+  }
+  return avx2_count<Avx2None , 0>( a , 0 , num_words );
+}
+template <int NW>
+__attribute__((target("avx2,popcnt")))
+static int avx2_popcount_and( const uint64_t *a , const uint64_t *b ,
+                              int num_words ) {
+  if( NW == num_words ) {
+    return avx2_count<Avx2And , NW>( a , b , NW );
+  }
+  return avx2_count<Avx2And , 0>( a , b , num_words );
+}
+template <int NW>
+__attribute__((target("avx2,popcnt")))
+static int avx2_popcount_andnot( const uint64_t *a , const uint64_t *b ,
+                                 int num_words ) {
+  if( NW == num_words ) {
+    return avx2_count<Avx2AndNot , NW>( a , b , NW );
+  }
+  return avx2_count<Avx2AndNot , 0>( a , b , num_words );
+}
+
+// ****************************************************************************
+template <int NW>
+static PopcountKernels avx2_kernels() {
+  PopcountKernels k = { "AVX2" , &avx2_popcount<NW> ,
+                        &avx2_popcount_and<NW> ,
+                        &avx2_popcount_andnot<NW> };
+  return k;
+}
+#endif
+
+#ifdef DAC_AVX512_KERNELS
+// ****************************************************************************
+// AVX-512 has a proper vector popcount, so it's just 8 words at a time with
+// a masked load for the ragged end.
+struct Avx512None {
+  __attribute__((target("avx512f")))
+  static __m512i load( __mmask8 m , const uint64_t *a ,
+                       const uint64_t *b __attribute__((unused)) ) {
+    return _mm512_maskz_loadu_epi64( m , a );
+  }
+};
+struct Avx512And {
+  __attribute__((target("avx512f")))
+  static __m512i load( __mmask8 m , const uint64_t *a , const uint64_t *b ) {
+    return _mm512_and_si512( _mm512_maskz_loadu_epi64( m , a ) ,
+                             _mm512_maskz_loadu_epi64( m , b ) );
+  }
+};
+struct Avx512AndNot {
+  __attribute__((target("avx512f")))
+  static __m512i load( __mmask8 m , const uint64_t *a , const uint64_t *b ) {
+    // not _mm512_andnot_si512, which trips gcc 12's uninitialised warnings
+    return _mm512_and_si512( _mm512_maskz_loadu_epi64( m , a ) ,
+                             _mm512_xor_si512( _mm512_maskz_loadu_epi64( m , b ) ,
+                                               _mm512_set1_epi64( -1 ) ) );
+  }
+};
+
+// ****************************************************************************
+template <class Op , int NW>
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static inline int avx512_count( const uint64_t *a , const uint64_t *b ,
+                                int num_words ) {
+
+  const int n = NW ? NW : num_words;
+  __m512i total = _mm512_setzero_si512();
+  int i = 0;
+  for( ; i + 8 <= n ; i += 8 ) {
+    total = _mm512_add_epi64( total ,
+                              _mm512_popcnt_epi64( Op::load( 0xFF , a + i ,
+                                                             b ? b + i : 0 ) ) );
+  }
+  if( i < n ) {
+    __mmask8 m = __mmask8( ( 1U << ( n - i ) ) - 1 );
+    total = _mm512_add_epi64( total ,
+                              _mm512_popcnt_epi64( Op::load( m , a + i ,
+                                                             b ? b + i : 0 ) ) );
+  }
+  uint64_t lanes[8];
+  _mm512_storeu_si512( lanes , total );
+  return int( lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+              lanes[4] + lanes[5] + lanes[6] + lanes[7] );
+
+}
+
+// ****************************************************************************
+template <int NW>
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int avx512_popcount( const uint64_t *a , int num_words ) {
+  if( NW == num_words ) {
+    return avx512_count<Avx512None , NW>( a , 0 , NW );
+  }
+  return avx512_count<Avx512None , 0>( a , 0 , num_words );
+}
+template <int NW>
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int avx512_popcount_and( const uint64_t *a , const uint64_t *b ,
+                                int num_words ) {
+  if( NW == num_words ) {
+    return avx512_count<Avx512And , NW>( a , b , NW );
+  }
+  return avx512_count<Avx512And , 0>( a , b , num_words );
+}
+template <int NW>
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int avx512_popcount_andnot( const uint64_t *a , const uint64_t *b ,
+                                   int num_words ) {
+  if( NW == num_words ) {
+    return avx512_count<Avx512AndNot , NW>( a , b , NW );
+  }
+  return avx512_count<Avx512AndNot , 0>( a , b , num_words );
+}
+
+// ****************************************************************************
+template <int NW>
+static PopcountKernels avx512_kernels() {
+  PopcountKernels k = { "AVX512" , &avx512_popcount<NW> ,
+                        &avx512_popcount_and<NW> ,
+                        &avx512_popcount_andnot<NW> };
+  return k;
+}
+#endif
+
+// ****************************************************************************
+// Intersection counts for not-hashed fingerprints, which are sorted lists
+// of unique fragment numbers.  The vector versions compare a block of each
+// list with every rotation of the other, after Schlegel B, Willhalm T,
+// Lehner W, "Fast Sorted-Set Intersection using SIMD Instructions", ADMS
+// 2011, and Lemire D, Boytsov L, Kurz N, "SIMD Compression and the
+// Intersection of Sorted Integers", Software: Practice and Experience 2016
+// (arXiv:1401.6399).  Whichever block has the smaller last element is done
+// with, so the blocks move through the lists just as the elements do in a
+// merge.
+// All of them give up once the matches so far plus the elements left in the
+// shorter list can't reach min_count, and return what they have, which is
+// then less than min_count.
+
+// lists more than this times longer than the other are searched rather than
+// walked through.
+static const int GALLOP_RATIO = 32;
+
+// ****************************************************************************
+// the merge, from a[i] and b[j] on, with num_in_common already found.  The
+// comparisons are turned into arithmetic, as which way the merge goes is
+// essentially random and would keep the branch predictor guessing.
+static inline int merge_count( const uint32_t *a , int i , int num_a ,
+                               const uint32_t *b , int j , int num_b ,
+                               int num_in_common , int min_count ) {
+
+  while( i < num_a && j < num_b ) {
+    if( num_in_common + min( num_a - i , num_b - j ) < min_count ) {
+      break;
+    }
+    uint32_t x = a[i] , y = b[j];
+    num_in_common += ( x == y );
+    i += ( x <= y );
+    j += ( y <= x );
+  }
+  return num_in_common;
+
+}
+
+// ****************************************************************************
+// for a short list against a long one, galloping search through the long
+// one for each element of the short one: doubling steps from where the last
+// search finished until past it, then a binary search of the last step.
+static int gallop_count( const uint32_t *a , int num_a ,
+                         const uint32_t *b , int num_b , int min_count ) {
+
+  int num_in_common = 0;
+  int j = 0;
+  for( int i = 0 ; i < num_a && j < num_b ; ++i ) {
+    if( num_in_common + min( num_a - i , num_b - j ) < min_count ) {
+      break;
+    }
+    uint32_t x = a[i];
+    int hi = j , step = 1;
+    while( hi < num_b && b[hi] < x ) {
+      j = hi + 1;
+      hi += step;
+      step <<= 1;
+    }
+    j = lower_bound( b + j , b + min( hi , num_b ) , x ) - b;
+    if( j < num_b && b[j] == x ) {
+      ++num_in_common;
+      ++j;
+    }
+  }
+  return num_in_common;
+
+}
+
+// ****************************************************************************
+static int generic_block_count( const uint32_t *a , int num_a ,
+                                const uint32_t *b , int num_b ,
+                                int min_count ) {
+  return merge_count( a , 0 , num_a , b , 0 , num_b , 0 , min_count );
+}
+
+// ****************************************************************************
+// the entry point, which picks between galloping and the block count.
+template <int (*block_count)( const uint32_t * , int , const uint32_t * ,
+                              int , int )>
+static int intersect_count_with( const uint32_t *a , int num_a ,
+                                 const uint32_t *b , int num_b ,
+                                 int min_count ) {
+
+  if( num_a > num_b ) {
+    swap( a , b );
+    swap( num_a , num_b );
+  }
+  if( num_a < min_count ) {
+    return num_a;
+  }
+  if( num_b / GALLOP_RATIO > num_a ) {
+    return gallop_count( a , num_a , b , num_b , min_count );
+  }
+  return block_count( a , num_a , b , num_b , min_count );
+
+}
+
+// ****************************************************************************
+void encode_frag_nums( const uint32_t *frag_nums , int num_frag_nums ,
+                       vector<unsigned char> &bytes ) {
+
+  uint32_t prev = 0;
+  for( int i = 0 ; i < num_frag_nums ; ++i ) {
+    uint32_t delta = frag_nums[i] - prev;
+    prev = frag_nums[i];
+    while( delta >= 0x80 ) {
+      bytes.push_back( static_cast<unsigned char>( delta | 0x80 ) );
+      delta >>= 7;
+    }
+    bytes.push_back( static_cast<unsigned char>( delta ) );
+  }
+
+}
+
+// ****************************************************************************
+// the next difference from bytes, which is moved on past it.
+static inline uint32_t next_delta( const unsigned char *&bytes ) {
+
+  uint32_t delta = *bytes & 0x7F;
+  for( int shift = 7 ; *bytes++ & 0x80 ; shift += 7 ) {
+    delta |= uint32_t( *bytes & 0x7F ) << shift;
+  }
+  return delta;
+
+}
+
+// ****************************************************************************
+void decode_frag_nums( const unsigned char *bytes , int num_frag_nums ,
+                       vector<uint32_t> &frag_nums ) {
+
+  uint32_t val = 0;
+  for( int i = 0 ; i < num_frag_nums ; ++i ) {
+    val += next_delta( bytes );
+    frag_nums.push_back( val );
+  }
+
+}
+
+// ****************************************************************************
+// the numbers of a can only be had in order, so it's a merge, with b
+// searched rather than walked through if it's much the longer.
+int intersect_count_compact( const unsigned char *a , int num_a ,
+                             const uint32_t *b , int num_b , int min_count ) {
+
+  bool gallop = num_b / GALLOP_RATIO > num_a;
+  int num_in_common = 0;
+  uint32_t x = 0;
+  int j = 0;
+  for( int i = 0 ; i < num_a && j < num_b ; ++i ) {
+    if( num_in_common + min( num_a - i , num_b - j ) < min_count ) {
+      break;
+    }
+    x += next_delta( a );
+    if( gallop ) {
+      int hi = j , step = 1;
+      while( hi < num_b && b[hi] < x ) {
+        j = hi + 1;
+        hi += step;
+        step <<= 1;
+      }
+      j = lower_bound( b + j , b + min( hi , num_b ) , x ) - b;
+    } else {
+      while( j < num_b && b[j] < x ) {
+        ++j;
+      }
+    }
+    if( j < num_b && b[j] == x ) {
+      ++num_in_common;
+      ++j;
+    }
+  }
+  return num_in_common;
+
+}
+
+#ifdef DAC_X86_KERNELS
+// ****************************************************************************
+// 4 x 4 blocks with SSE2, which every x86-64 has.
+__attribute__((target("sse2,popcnt")))
+static int sse_block_count( const uint32_t *a , int num_a ,
+                            const uint32_t *b , int num_b , int min_count ) {
+
+  int i = 0 , j = 0 , num_in_common = 0;
+  while( i + 4 <= num_a && j + 4 <= num_b ) {
+    if( num_in_common + min( num_a - i , num_b - j ) < min_count ) {
+      return num_in_common;
+    }
+    __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + i ) );
+    __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i *>( b + j ) );
+    __m128i eq = _mm_cmpeq_epi32( va , vb );
+    vb = _mm_shuffle_epi32( vb , _MM_SHUFFLE( 0 , 3 , 2 , 1 ) );
+    eq = _mm_or_si128( eq , _mm_cmpeq_epi32( va , vb ) );
+    vb = _mm_shuffle_epi32( vb , _MM_SHUFFLE( 0 , 3 , 2 , 1 ) );
+    eq = _mm_or_si128( eq , _mm_cmpeq_epi32( va , vb ) );
+    vb = _mm_shuffle_epi32( vb , _MM_SHUFFLE( 0 , 3 , 2 , 1 ) );
+    eq = _mm_or_si128( eq , _mm_cmpeq_epi32( va , vb ) );
+    num_in_common += __builtin_popcount( _mm_movemask_ps( _mm_castsi128_ps( eq ) ) );
+    uint32_t a_last = a[i + 3] , b_last = b[j + 3];
+    i += ( a_last <= b_last ) ? 4 : 0;
+    j += ( b_last <= a_last ) ? 4 : 0;
+  }
+  return merge_count( a , i , num_a , b , j , num_b , num_in_common ,
+                      min_count );
+
+}
+#endif
+
+#ifdef DAC_AVX2_KERNELS
+// ****************************************************************************
+// 8 x 8 blocks with AVX2, rotating b's block a lane at a time with VPERMD.
+__attribute__((target("avx2,popcnt")))
+static int avx2_block_count( const uint32_t *a , int num_a ,
+                             const uint32_t *b , int num_b , int min_count ) {
+
+  const __m256i rotate = _mm256_set_epi32( 0 , 7 , 6 , 5 , 4 , 3 , 2 , 1 );
+  int i = 0 , j = 0 , num_in_common = 0;
+  while( i + 8 <= num_a && j + 8 <= num_b ) {
+    if( num_in_common + min( num_a - i , num_b - j ) < min_count ) {
+      return num_in_common;
+    }
+    __m256i va = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( a + i ) );
+    __m256i vb = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( b + j ) );
+    __m256i eq = _mm256_cmpeq_epi32( va , vb );
+    for( int r = 1 ; r < 8 ; ++r ) {
+      vb = _mm256_permutevar8x32_epi32( vb , rotate );
+      eq = _mm256_or_si256( eq , _mm256_cmpeq_epi32( va , vb ) );
+    }
+    num_in_common += __builtin_popcount( _mm256_movemask_ps( _mm256_castsi256_ps( eq ) ) );
+    uint32_t a_last = a[i + 7] , b_last = b[j + 7];
+    i += ( a_last <= b_last ) ? 8 : 0;
+    j += ( b_last <= a_last ) ? 8 : 0;
+  }
+  return merge_count( a , i , num_a , b , j , num_b , num_in_common ,
+                      min_count );
+
+}
+#endif
+
+// ****************************************************************************
+// constant-initialised, so it's safe to use even from other static
+// initialisers that happen to run before select_kernel_flavour.
+PopcountKernels POPCOUNT_KERNELS = { "GENERIC" , &generic_popcount<0> ,
+                                     &generic_popcount_and<0> ,
+                                     &generic_popcount_andnot<0> };
+pIntersectCount INTERSECT_COUNT_KERNEL = &intersect_count_with<&generic_block_count>;
+
+typedef enum { GENERIC_KERNELS , POPCNT_KERNELS , AVX2_KERNELS ,
+               AVX512_KERNELS } KERNEL_FLAVOUR;
+static KERNEL_FLAVOUR kernel_flavour = GENERIC_KERNELS;
+
+// ****************************************************************************
+// pick the best kernels the CPU can run, unless FLUSH_POPCOUNT_KERNEL says
+// otherwise.  Asking for something the CPU can't do gets the best it can.
+static KERNEL_FLAVOUR select_kernel_flavour() {
+
+  string wanted;
+  const char *env = getenv( "FLUSH_POPCOUNT_KERNEL" );
+  if( env ) {
+    wanted = env;
+  }
+  if( "GENERIC" == wanted ) {
+    return GENERIC_KERNELS;
+  }
+
+#ifdef DAC_X86_KERNELS
+  __builtin_cpu_init();
+#ifdef DAC_AVX512_KERNELS
+  if( ( wanted.empty() || "AVX512" == wanted ) &&
+      __builtin_cpu_supports( "avx512f" ) &&
+      __builtin_cpu_supports( "avx512vpopcntdq" ) ) {
+    return AVX512_KERNELS;
+  }
+#endif
+#ifdef DAC_AVX2_KERNELS
+  if( "POPCNT" != wanted && __builtin_cpu_supports( "avx2" ) &&
+      __builtin_cpu_supports( "popcnt" ) ) {
+    return AVX2_KERNELS;
+  }
+#endif
+  if( __builtin_cpu_supports( "popcnt" ) ) {
+    return POPCNT_KERNELS;
+  }
+#endif
+
+  return GENERIC_KERNELS;
+
+}
+
+// ****************************************************************************
+// the kernels of the chosen flavour for a width of NW words, 0 meaning any
+// width.  Below a vector's worth of words, and for AVX2 below the 8-vector
+// blocks that Harley-Seal needs to get going, unrolled POPCNT is quicker.
+template <int NW>
+static PopcountKernels flavour_kernels() {
+
+  switch( kernel_flavour ) {
+#ifdef DAC_AVX512_KERNELS
+  case AVX512_KERNELS :
+    return ( NW && NW < 8 ) ? popcnt_kernels<NW>() : avx512_kernels<NW>();
+#endif
+#ifdef DAC_AVX2_KERNELS
+  case AVX2_KERNELS :
+    return ( NW && NW < 64 ) ? popcnt_kernels<NW>() : avx2_kernels<NW>();
+#endif
+#ifdef DAC_X86_KERNELS
+  case POPCNT_KERNELS :
+    return popcnt_kernels<NW>();
+#endif
+  default :
+    return generic_kernels<NW>();
+  }
+
+}
+
+// ****************************************************************************
+// AVX-512 has nothing much to add to AVX2 for this.
+static pIntersectCount flavour_intersect_count() {
+
+  switch( kernel_flavour ) {
+#ifdef DAC_AVX2_KERNELS
+  case AVX512_KERNELS : case AVX2_KERNELS :
+    return &intersect_count_with<&avx2_block_count>;
+#endif
+#ifdef DAC_X86_KERNELS
+  case POPCNT_KERNELS :
+    return &intersect_count_with<&sse_block_count>;
+#endif
+  default :
+    return &intersect_count_with<&generic_block_count>;
+  }
+
+}
+
+// ****************************************************************************
+// x back to front, bit 0 to bit 31 and so on.
+static inline uint32_t reverse_bits( uint32_t x ) {
+
+  x = ( ( x >> 1 ) & 0x55555555U ) | ( ( x & 0x55555555U ) << 1 );
+  x = ( ( x >> 2 ) & 0x33333333U ) | ( ( x & 0x33333333U ) << 2 );
+  x = ( ( x >> 4 ) & 0x0F0F0F0FU ) | ( ( x & 0x0F0F0F0FU ) << 4 );
+  x = ( ( x >> 8 ) & 0x00FF00FFU ) | ( ( x & 0x00FF00FFU ) << 8 );
+  return ( x >> 16 ) | ( x << 16 );
+
+}
+
+#ifdef DAC_X86_KERNELS
+// ****************************************************************************
+// the 32 characters at chars as an int, first character in the top bit.
+// They're compared with '1' 16 at a time and the answers movemasked into
+// bits, which come out first character lowest, so they're reversed after.
+__attribute__((target("sse2")))
+static inline unsigned int pack_32_chars( const char *chars ) {
+
+  const __m128i ones = _mm_set1_epi8( '1' );
+  __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i *>( chars ) );
+  __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i *>( chars + 16 ) );
+  uint32_t x = uint32_t( _mm_movemask_epi8( _mm_cmpeq_epi8( lo , ones ) ) )
+      | ( uint32_t( _mm_movemask_epi8( _mm_cmpeq_epi8( hi , ones ) ) ) << 16 );
+  return reverse_bits( x );
+
+}
+#else
+// ****************************************************************************
+static inline unsigned int pack_32_chars( const char *chars ) {
+
+  unsigned int word = 0;
+  for( int i = 0 ; i < 32 ; ++i ) {
+    word = ( word << 1 ) | ( '1' == chars[i] );
+  }
+  return word;
+
+}
+#endif
+
+// ****************************************************************************
+int pack_bitstring( const char *chars , size_t num_chars , unsigned int *bits ) {
+
+  size_t num_ints = ( num_chars + 31 ) / 32;
+  size_t padding = num_ints * 32 - num_chars;
+  size_t i = 0;
+  int num_set = 0;
+  if( padding ) {
+    unsigned int word = 0;
+    for( size_t q = 0 ; q < 32 - padding ; ++q ) {
+      word = ( word << 1 ) | ( '1' == chars[q] );
+    }
+    bits[i++] = word;
+    num_set += __builtin_popcount( word );
+    chars += 32 - padding;
+  }
+  for( ; i < num_ints ; ++i , chars += 32 ) {
+    bits[i] = pack_32_chars( chars );
+    num_set += __builtin_popcount( bits[i] );
+  }
+  return num_set;
+
+}
+
+#ifdef DAC_X86_KERNELS
+// ****************************************************************************
+// the int as 32 characters, top bit first.  Each byte of it is spread over 8
+// bytes of a register, top byte first, picked out with a mask per bit, and
+// the all-ones bytes of the compare taken from '0' to make '1'.
+__attribute__((target("sse2")))
+static inline void unpack_32_chars( unsigned int word , char *chars ) {
+
+  const __m128i bits = _mm_set_epi8( 0x01 , 0x02 , 0x04 , 0x08 ,
+                                     0x10 , 0x20 , 0x40 , char( 0x80 ) ,
+                                     0x01 , 0x02 , 0x04 , 0x08 ,
+                                     0x10 , 0x20 , 0x40 , char( 0x80 ) );
+  const __m128i zeros = _mm_set1_epi8( '0' );
+  __m128i w = _mm_cvtsi32_si128( int( __builtin_bswap32( word ) ) );
+  w = _mm_unpacklo_epi8( w , w );
+  w = _mm_unpacklo_epi16( w , w );
+  __m128i lo = _mm_unpacklo_epi32( w , w );
+  __m128i hi = _mm_unpackhi_epi32( w , w );
+  lo = _mm_cmpeq_epi8( _mm_and_si128( lo , bits ) , bits );
+  hi = _mm_cmpeq_epi8( _mm_and_si128( hi , bits ) , bits );
+  _mm_storeu_si128( reinterpret_cast<__m128i *>( chars ) ,
+                    _mm_sub_epi8( zeros , lo ) );
+  _mm_storeu_si128( reinterpret_cast<__m128i *>( chars + 16 ) ,
+                    _mm_sub_epi8( zeros , hi ) );
+
+}
+#else
+// ****************************************************************************
+static inline void unpack_32_chars( unsigned int word , char *chars ) {
+
+  for( int i = 0 ; i < 32 ; ++i ) {
+    chars[i] = ( word & ( 1U << ( 31 - i ) ) ) ? '1' : '0';
+  }
+
+}
+#endif
+
+// ****************************************************************************
+void unpack_bitstring( const unsigned int *bits , size_t num_ints ,
+                       char *chars ) {
+
+  for( size_t i = 0 ; i < num_ints ; ++i , chars += 32 ) {
+    unpack_32_chars( bits[i] , chars );
+  }
+
+}
+
+// ****************************************************************************
+// the value of hex digit c, or -1 if it isn't one
+static inline int hex_value( char c ) {
+
+  if( c >= '0' && c <= '9' ) {
+    return c - '0';
+  } else if( c >= 'a' && c <= 'f' ) {
+    return c - 'a' + 10;
+  } else if( c >= 'A' && c <= 'F' ) {
+    return c - 'A' + 10;
+  }
+  return -1;
+
+}
+
+#ifdef DAC_X86_KERNELS
+// ****************************************************************************
+// 16 hex digits into 8 bytes, each pair of digits high half first.  The
+// digits and letters are found with unsigned range checks, min( x , n ) == x
+// being x <= n, and their values put side by side in 16-bit lanes to be
+// shifted together and packed down.  False if any of them isn't a hex digit.
+__attribute__((target("sse2")))
+static inline bool unhex_16_chars( const char *hex , unsigned char *bytes ) {
+
+  __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i *>( hex ) );
+  __m128i digit = _mm_sub_epi8( c , _mm_set1_epi8( '0' ) );
+  __m128i is_digit = _mm_cmpeq_epi8( _mm_min_epu8( digit , _mm_set1_epi8( 9 ) ) ,
+                                     digit );
+  // setting the 0x20 bit makes capitals lower case, and leaves digits be
+  __m128i letter = _mm_sub_epi8( _mm_or_si128( c , _mm_set1_epi8( 0x20 ) ) ,
+                                 _mm_set1_epi8( 'a' ) );
+  __m128i is_letter = _mm_cmpeq_epi8( _mm_min_epu8( letter , _mm_set1_epi8( 5 ) ) ,
+                                      letter );
+  if( 0xFFFF != _mm_movemask_epi8( _mm_or_si128( is_digit , is_letter ) ) ) {
+    return false;
+  }
+  __m128i val = _mm_or_si128( _mm_and_si128( is_digit , digit ) ,
+                              _mm_and_si128( is_letter ,
+                                             _mm_add_epi8( letter , _mm_set1_epi8( 10 ) ) ) );
+  // the first digit of each pair is in the low byte of its lane
+  __m128i pairs = _mm_or_si128( _mm_slli_epi16( _mm_and_si128( val , _mm_set1_epi16( 0x00FF ) ) , 4 ) ,
+                                _mm_srli_epi16( val , 8 ) );
+  _mm_storel_epi64( reinterpret_cast<__m128i *>( bytes ) ,
+                    _mm_packus_epi16( pairs , pairs ) );
+  return true;
+
+}
+#endif
+
+// ****************************************************************************
+int pack_hex_fingerprint( const char *hex , size_t num_hex , size_t num_bits ,
+                          unsigned int *bits ) {
+
+  size_t num_bytes = num_hex / 2;
+  size_t num_ints = ( num_bytes + 3 ) / 4;
+  // the bytes go into bits as they are, after any padding, and each int is
+  // turned round after.
+  unsigned char *bytes = reinterpret_cast<unsigned char *>( bits );
+  size_t padding = num_ints * 4 - num_bytes;
+  std::fill( bytes , bytes + padding , 0 );
+  bytes += padding;
+
+  size_t i = 0;
+#ifdef DAC_X86_KERNELS
+  for( ; i + 16 <= num_bytes * 2 ; i += 16 ) {
+    if( !unhex_16_chars( hex + i , bytes + i / 2 ) ) {
+      return -1;
+    }
+  }
+#endif
+  for( ; i + 1 < num_bytes * 2 ; i += 2 ) {
+    int hi = hex_value( hex[i] );
+    int lo = hex_value( hex[i + 1] );
+    if( hi < 0 || lo < 0 ) {
+      return -1;
+    }
+    bytes[i / 2] = static_cast<unsigned char>( ( hi << 4 ) | lo );
+  }
+
+  // bit 0 of the first byte is the first bit, which goes at the top
+  bytes = reinterpret_cast<unsigned char *>( bits );
+  for( size_t j = 0 ; j < num_ints ; ++j , bytes += 4 ) {
+    uint32_t x = uint32_t( bytes[0] ) | ( uint32_t( bytes[1] ) << 8 )
+        | ( uint32_t( bytes[2] ) << 16 ) | ( uint32_t( bytes[3] ) << 24 );
+    bits[j] = reverse_bits( x );
+  }
+
+  // the bits are padded to whole bytes so far.  If there are fewer than
+  // that, they all move down the rest of the way, and the unused ones at the
+  // end of the last byte go.
+  unsigned int shift = num_bits && num_bits < num_bytes * 8 ?
+      num_bytes * 8 - num_bits : 0;
+  if( shift ) {
+    for( size_t j = num_ints ; j-- > 0 ; ) {
+      bits[j] = ( bits[j] >> shift )
+          | ( j ? bits[j - 1] << ( 32 - shift ) : 0 );
+    }
+  }
+
+  int num_set = 0;
+  for( size_t j = 0 ; j < num_ints ; ++j ) {
+    num_set += __builtin_popcount( bits[j] );
+  }
+  return num_set;
+
+}
+
+// ****************************************************************************
+size_t unpack_hex_fingerprint( const unsigned int *bits , size_t num_ints ,
+                               size_t num_bits , char *hex ) {
+
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  if( !num_bits || num_bits > num_ints * 32 ) {
+    num_bits = num_ints * 32;
+  }
+  // the padding in front of the first bit is skip whole bytes and shift
+  // bits, and the ints are moved up by shift as they go out.
+  size_t num_bytes = ( num_bits + 7 ) / 8;
+  size_t skip = num_ints * 4 - num_bytes;
+  unsigned int shift = num_bytes * 8 - num_bits;
+  char *h = hex;
+  for( size_t i = 0 ; i < num_ints ; ++i ) {
+    uint32_t w = bits[i];
+    if( shift ) {
+      w = ( w << shift )
+          | ( i + 1 < num_ints ? bits[i + 1] >> ( 32 - shift ) : 0 );
+    }
+    uint32_t x = reverse_bits( w );
+    for( int j = 0 ; j < 4 ; ++j , x >>= 8 ) {
+      if( skip ) {
+        --skip;
+        continue;
+      }
+      *h++ = HEX_DIGITS[( x >> 4 ) & 0xF];
+      *h++ = HEX_DIGITS[x & 0xF];
+    }
+  }
+  return h - hex;
+
+}
+
+// ****************************************************************************
+void set_popcount_width( int num_words ) {
+
+  switch( num_words ) {
+  case 3 : // 166-bit MACCS keys
+    POPCOUNT_KERNELS = flavour_kernels<3>();
+    break;
+  case 8 :
+    POPCOUNT_KERNELS = flavour_kernels<8>();
+    break;
+  case 16 :
+    POPCOUNT_KERNELS = flavour_kernels<16>();
+    break;
+  case 32 :
+    POPCOUNT_KERNELS = flavour_kernels<32>();
+    break;
+  case 64 :
+    POPCOUNT_KERNELS = flavour_kernels<64>();
+    break;
+  default :
+    POPCOUNT_KERNELS = flavour_kernels<0>();
+    break;
+  }
+
+}
+
+// ****************************************************************************
+namespace {
+struct PopcountKernelsSelector {
+  PopcountKernelsSelector() {
+    kernel_flavour = select_kernel_flavour();
+    POPCOUNT_KERNELS = flavour_kernels<0>();
+    INTERSECT_COUNT_KERNEL = flavour_intersect_count();
+  }
+};
+PopcountKernelsSelector popcount_kernels_selector;
+}
+
+} // end of namespace DAC_FINGERPRINTS
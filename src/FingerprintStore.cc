@@ -0,0 +1,735 @@
+//
+// file FingerprintStore.cc
+// 16th October 2026
+//
+
+#include "FingerprintStore.H"
+#include "HashedFingerprint.H"
+#include "NotHashedFingerprint.H"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <typeinfo>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// the rows of the bit matrix start on cache-line boundaries as long as the
+// rows are a whole number of cache lines, which they are for the usual
+// widths, and the matrix itself always does.
+static const size_t BITS_ALIGNMENT = 64;
+
+// ****************************************************************************
+FingerprintStore::FingerprintStore() :
+  hashed_( true ) , compact_( false ) , num_words_( 0 ) , capacity_( 0 ) ,
+  bits_( 0 ) , fold_words_( 0 ) {
+
+  frag_starts_.push_back( 0 );
+  name_starts_.push_back( 0 );
+
+}
+
+// ****************************************************************************
+FingerprintStore::FingerprintStore( bool compact_frag_nums ) :
+  hashed_( true ) , compact_( compact_frag_nums ) , num_words_( 0 ) ,
+  capacity_( 0 ) , bits_( 0 ) , fold_words_( 0 ) {
+
+  frag_starts_.push_back( 0 );
+  name_starts_.push_back( 0 );
+
+}
+
+// ****************************************************************************
+FingerprintStore::~FingerprintStore() {
+
+  free( bits_ );
+
+}
+
+// ****************************************************************************
+void FingerprintStore::clear() {
+
+  folds_.clear();
+  fold_bits_set_.clear();
+  frag_nums_.clear();
+  frag_bytes_.clear();
+  frag_starts_.resize( 1 );
+  num_bits_set_.clear();
+  names_.clear();
+  name_starts_.resize( 1 );
+
+}
+
+// ****************************************************************************
+void FingerprintStore::reserve( unsigned int num_fps ) {
+
+  if( num_fps <= capacity_ || !HashedFingerprint::num_words() ) {
+    return;
+  }
+  if( empty() ) {
+    num_words_ = HashedFingerprint::num_words();
+  }
+
+  void *new_bits = 0;
+  size_t num_bytes = size_t( num_fps ) * num_words_ * sizeof( uint64_t );
+  if( posix_memalign( &new_bits , BITS_ALIGNMENT , num_bytes ) ) {
+    throw bad_alloc();
+  }
+  if( bits_ ) {
+    memcpy( new_bits , bits_ , size_t( size() ) * num_words_ * sizeof( uint64_t ) );
+    free( bits_ );
+  }
+  bits_ = static_cast<uint64_t *>( new_bits );
+  capacity_ = num_fps;
+
+}
+
+// ****************************************************************************
+void FingerprintStore::add( const FingerprintBase &fp ) {
+
+  if( typeid( fp ) == typeid( HashedFingerprint ) ) {
+    const HashedFingerprint &hfp = static_cast<const HashedFingerprint &>( fp );
+    add_hashed( hfp.get_name() , hfp.get_finger_bits() );
+  } else if( typeid( fp ) == typeid( NotHashedFingerprint ) ) {
+    const NotHashedFingerprint &nhfp = static_cast<const NotHashedFingerprint &>( fp );
+    add_not_hashed( nhfp.get_name() , nhfp.get_frag_nums() ,
+                    nhfp.num_frag_nums() );
+  } else {
+    throw IncompatibleFingerprintError( "FingerprintStore::add" );
+  }
+
+}
+
+// ****************************************************************************
+void FingerprintStore::add_hashed( const string &name ,
+                                   const unsigned int *finger_bits ) {
+
+  if( empty() ) {
+    hashed_ = true;
+    if( num_words_ != HashedFingerprint::num_words() ) {
+      capacity_ = 0; // so the matrix is made again with the new row length
+      num_words_ = HashedFingerprint::num_words();
+    }
+  } else if( !hashed_ ) {
+    throw IncompatibleFingerprintError( "FingerprintStore::add" );
+  } else if( num_words_ != HashedFingerprint::num_words() ) {
+    throw HashedFingerprintLengthError( 2 * HashedFingerprint::num_words() ,
+                                        2 * num_words_ );
+  }
+
+  uint64_t *row = new_row();
+  // the padding at the end of the row must be zero, as the kernels count it.
+  fill( row , row + num_words_ , uint64_t( 0 ) );
+  memcpy( row , finger_bits , HashedFingerprint::num_ints() * sizeof( unsigned int ) );
+  num_bits_set_.push_back( popcount_words( row , num_words_ ) );
+  if( fold_words_ ) {
+    add_fold( size() - 1 );
+  }
+  add_name( name );
+
+}
+
+// ****************************************************************************
+void FingerprintStore::add_not_hashed( const string &name ,
+                                       const uint32_t *frag_nums ,
+                                       int num_frag_nums ) {
+
+  if( empty() ) {
+    hashed_ = false;
+  } else if( hashed_ ) {
+    throw IncompatibleFingerprintError( "FingerprintStore::add" );
+  }
+
+  if( compact_ ) {
+    encode_frag_nums( frag_nums , num_frag_nums , frag_bytes_ );
+    frag_starts_.push_back( frag_bytes_.size() );
+  } else {
+    frag_nums_.insert( frag_nums_.end() , frag_nums , frag_nums + num_frag_nums );
+    frag_starts_.push_back( frag_nums_.size() );
+  }
+  num_bits_set_.push_back( num_frag_nums );
+  add_name( name );
+
+}
+
+// ****************************************************************************
+// everything is shuffled down in place, so there's no extra memory needed.
+// Nothing is ever copied up, so nothing is overwritten before it's moved.
+void FingerprintStore::keep( const vector<char> &keep_fps ) {
+
+  unsigned int j = 0;
+  size_t next_frag = 0 , next_name = 0;
+  for( unsigned int i = 0 , is = size() ; i < is ; ++i ) {
+    if( !keep_fps[i] ) {
+      continue;
+    }
+    if( hashed_ ) {
+      if( i != j ) {
+        memcpy( bits_ + size_t( j ) * num_words_ , bits( i ) ,
+                num_words_ * sizeof( uint64_t ) );
+        if( fold_words_ ) {
+          copy( folds_.begin() + size_t( i ) * fold_words_ ,
+                folds_.begin() + size_t( i + 1 ) * fold_words_ ,
+                folds_.begin() + size_t( j ) * fold_words_ );
+          fold_bits_set_[j] = fold_bits_set_[i];
+        }
+      }
+    } else {
+      size_t frag_start = frag_starts_[i] , frag_stop = frag_starts_[i + 1];
+      if( compact_ ) {
+        copy( frag_bytes_.begin() + frag_start , frag_bytes_.begin() + frag_stop ,
+              frag_bytes_.begin() + next_frag );
+      } else {
+        copy( frag_nums_.begin() + frag_start , frag_nums_.begin() + frag_stop ,
+              frag_nums_.begin() + next_frag );
+      }
+      frag_starts_[j] = next_frag;
+      next_frag += frag_stop - frag_start;
+    }
+    size_t name_start = name_starts_[i] , name_stop = name_starts_[i + 1];
+    copy( names_.begin() + name_start , names_.begin() + name_stop ,
+          names_.begin() + next_name );
+    name_starts_[j] = next_name;
+    next_name += name_stop - name_start;
+    num_bits_set_[j] = num_bits_set_[i];
+    ++j;
+  }
+
+  num_bits_set_.resize( j );
+  if( hashed_ && fold_words_ ) {
+    folds_.resize( size_t( j ) * fold_words_ );
+    fold_bits_set_.resize( j );
+  }
+  if( compact_ ) {
+    frag_bytes_.resize( next_frag );
+  } else {
+    frag_nums_.resize( next_frag );
+  }
+  frag_starts_.resize( j + 1 );
+  frag_starts_[j] = next_frag;
+  names_.resize( next_name );
+  name_starts_.resize( j + 1 );
+  name_starts_[j] = next_name;
+
+}
+
+// ****************************************************************************
+namespace {
+struct FewerBitsSet {
+  explicit FewerBitsSet( const vector<int> &num_bits_set ) :
+    num_bits_set_( num_bits_set ) {}
+  bool operator()( unsigned int i , unsigned int j ) const {
+    return num_bits_set_[i] < num_bits_set_[j];
+  }
+  const vector<int> &num_bits_set_;
+};
+}
+
+// ****************************************************************************
+// everything is copied into new arrays in the new order, so for a while it
+// takes twice the memory.
+void FingerprintStore::sort_by_num_bits_set( vector<unsigned int> &old_nums ) {
+
+  old_nums.resize( size() );
+  for( unsigned int i = 0 , is = size() ; i < is ; ++i ) {
+    old_nums[i] = i;
+  }
+  stable_sort( old_nums.begin() , old_nums.end() , FewerBitsSet( num_bits_set_ ) );
+
+  vector<int> new_num_bits_set( size() ) , new_fold_bits_set( fold_bits_set_.size() );
+  vector<uint64_t> new_folds( folds_.size() );
+  vector<uint32_t> new_frag_nums;
+  vector<unsigned char> new_frag_bytes;
+  vector<size_t> new_frag_starts( 1 , 0 );
+  vector<char> new_names;
+  vector<size_t> new_name_starts( 1 , 0 );
+  uint64_t *new_bits = 0;
+  if( hashed_ && bits_ ) {
+    void *nb = 0;
+    if( posix_memalign( &nb , BITS_ALIGNMENT ,
+                        size_t( capacity_ ) * num_words_ * sizeof( uint64_t ) ) ) {
+      throw bad_alloc();
+    }
+    new_bits = static_cast<uint64_t *>( nb );
+  }
+  new_frag_nums.reserve( frag_nums_.size() );
+  new_frag_bytes.reserve( frag_bytes_.size() );
+  new_frag_starts.reserve( frag_starts_.size() );
+  new_names.reserve( names_.size() );
+  new_name_starts.reserve( name_starts_.size() );
+
+  for( unsigned int i = 0 , is = size() ; i < is ; ++i ) {
+    unsigned int k = old_nums[i];
+    new_num_bits_set[i] = num_bits_set_[k];
+    if( hashed_ ) {
+      memcpy( new_bits + size_t( i ) * num_words_ , bits( k ) ,
+              num_words_ * sizeof( uint64_t ) );
+      if( fold_words_ ) {
+        copy( folds_.begin() + size_t( k ) * fold_words_ ,
+              folds_.begin() + size_t( k + 1 ) * fold_words_ ,
+              new_folds.begin() + size_t( i ) * fold_words_ );
+        new_fold_bits_set[i] = fold_bits_set_[k];
+      }
+    } else if( compact_ ) {
+      new_frag_bytes.insert( new_frag_bytes.end() ,
+                             frag_bytes_.begin() + frag_starts_[k] ,
+                             frag_bytes_.begin() + frag_starts_[k + 1] );
+      new_frag_starts.push_back( new_frag_bytes.size() );
+    } else {
+      new_frag_nums.insert( new_frag_nums.end() ,
+                            frag_nums_.begin() + frag_starts_[k] ,
+                            frag_nums_.begin() + frag_starts_[k + 1] );
+      new_frag_starts.push_back( new_frag_nums.size() );
+    }
+    new_names.insert( new_names.end() , names_.begin() + name_starts_[k] ,
+                      names_.begin() + name_starts_[k + 1] );
+    new_name_starts.push_back( new_names.size() );
+  }
+
+  if( hashed_ && bits_ ) {
+    free( bits_ );
+    bits_ = new_bits;
+  }
+  num_bits_set_.swap( new_num_bits_set );
+  fold_bits_set_.swap( new_fold_bits_set );
+  folds_.swap( new_folds );
+  if( !hashed_ ) {
+    frag_nums_.swap( new_frag_nums );
+    frag_bytes_.swap( new_frag_bytes );
+    frag_starts_.swap( new_frag_starts );
+  }
+  names_.swap( new_names );
+  name_starts_.swap( new_name_starts );
+
+}
+
+// ****************************************************************************
+// the bit counts that can be within the threshold of num_bits are an
+// interval around it, so each end is a binary search.
+void FingerprintStore::bit_bound_range( int num_bits ,
+                                        const TanimotoThreshold &threshold ,
+                                        unsigned int &start ,
+                                        unsigned int &stop ) const {
+
+  // the first that isn't below the interval
+  unsigned int lo = 0 , hi = size();
+  while( lo < hi ) {
+    unsigned int mid = lo + ( hi - lo ) / 2;
+    if( num_bits_set_[mid] < num_bits &&
+        !threshold.possible( num_bits_set_[mid] , num_bits ) ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  start = lo;
+
+  // and the first that's above it
+  hi = size();
+  while( lo < hi ) {
+    unsigned int mid = lo + ( hi - lo ) / 2;
+    if( num_bits_set_[mid] <= num_bits ||
+        threshold.possible( num_bits_set_[mid] , num_bits ) ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  stop = lo;
+
+}
+
+// ****************************************************************************
+void FingerprintStore::set_fold_bits( unsigned int fold_bits ) {
+
+  fold_words_ = fold_bits / 64;
+  folds_.clear();
+  fold_bits_set_.clear();
+  if( fold_words_ && hashed_ ) {
+    folds_.reserve( size_t( size() ) * fold_words_ );
+    fold_bits_set_.reserve( size() );
+    for( unsigned int i = 0 , is = size() ; i < is ; ++i ) {
+      add_fold( i );
+    }
+  }
+
+}
+
+// ****************************************************************************
+const uint32_t *FingerprintStore::frag_nums( unsigned int i ,
+                                             vector<uint32_t> &frag_nums ) const {
+
+  if( !compact_ ) {
+    return this->frag_nums( i );
+  }
+  frag_nums.clear();
+  decode_frag_nums( frag_bytes( i ) , num_bits_set( i ) , frag_nums );
+  return frag_nums.empty() ? 0 : &frag_nums[0];
+
+}
+
+// ****************************************************************************
+FingerprintView FingerprintStore::view( unsigned int i ,
+                                        vector<uint32_t> &frag_nums ) const {
+
+  FingerprintView v;
+  v.name_ = name_c_str( i );
+  v.name_len_ = name_starts_[i + 1] - name_starts_[i] - 1;
+  v.num_bits_set_ = num_bits_set( i );
+  if( hashed_ ) {
+    v.bits_ = bits( i );
+    v.frag_nums_ = 0;
+  } else {
+    v.bits_ = 0;
+    v.frag_nums_ = this->frag_nums( i , frag_nums );
+  }
+  return v;
+
+}
+
+// ****************************************************************************
+void FingerprintStore::get_names( vector<string> &names ) const {
+
+  names.reserve( names.size() + size() );
+  for( unsigned int i = 0 , is = size() ; i < is ; ++i ) {
+    names.push_back( name( i ) );
+  }
+
+}
+
+// ****************************************************************************
+void FingerprintStore::add_name( const string &name ) {
+
+  names_.insert( names_.end() , name.begin() , name.end() );
+  names_.push_back( '\0' );
+  name_starts_.push_back( names_.size() );
+
+}
+
+// ****************************************************************************
+// fold hashed fingerprint i onto the end of folds_.  Word k of the fold is the
+// OR of words k, k + fold_words_, k + 2 * fold_words_ and so on of the
+// fingerprint, which needn't be a whole number of folds long.
+void FingerprintStore::add_fold( unsigned int i ) {
+
+  size_t start = folds_.size();
+  folds_.resize( start + fold_words_ , uint64_t( 0 ) );
+  uint64_t *fold = &folds_[start];
+  const uint64_t *row = bits( i );
+  for( unsigned int k = 0 ; k < num_words_ ; ++k ) {
+    fold[k % fold_words_] |= row[k];
+  }
+  fold_bits_set_.push_back( popcount_words( fold , fold_words_ ) );
+
+}
+
+// ****************************************************************************
+// the space for the next hashed fingerprint, growing the matrix if necessary.
+// posix_memalign has no realloc, so it's done by hand.
+uint64_t *FingerprintStore::new_row() {
+
+  if( size() == capacity_ ) {
+    reserve( capacity_ ? 2 * capacity_ : 1024 );
+  }
+  return bits_ + size_t( size() ) * num_words_;
+
+}
+
+// ****************************************************************************
+// the rows of a store, as the arguments to the static distance functions of
+// HashedFingerprint and NotHashedFingerprint.
+static inline const uint64_t *store_row( const FingerprintStore &fps ,
+                                         unsigned int i , const uint64_t * ) {
+  return fps.bits( i );
+}
+static inline const uint32_t *store_row( const FingerprintStore &fps ,
+                                         unsigned int i , const uint32_t * ) {
+  return fps.frag_nums( i );
+}
+static inline const unsigned char *store_row( const FingerprintStore &fps ,
+                                              unsigned int i ,
+                                              const unsigned char * ) {
+  return fps.frag_bytes( i );
+}
+
+// ****************************************************************************
+// the loops for the distance calcs, instantiated for each distance function
+// or threshold test so the calls are direct.  Row is uint64_t for hashed
+// fingerprints and uint32_t or unsigned char for not hashed, and Query is
+// uint64_t or uint32_t to match.
+template <typename Row , typename Query , typename Threshold ,
+          bool (*within)( const Row * , int , const Query * , int ,
+                          const Threshold & , double & )>
+static int threshold_distances( const FingerprintStore &fps ,
+                                const Query *q , int q_num ,
+                                unsigned int start , unsigned int stop ,
+                                const Threshold &threshold , int *hit_nums ,
+                                double *hit_dists ) {
+
+  const Row *row_type = 0;
+  int num_hits = 0;
+  for( unsigned int j = start ; j < stop ; ++j ) {
+    if( within( store_row( fps , j , row_type ) , fps.num_bits_set( j ) ,
+                q , q_num , threshold , hit_dists[num_hits] ) ) {
+      hit_nums[num_hits] = j;
+      ++num_hits;
+    }
+  }
+
+  return num_hits;
+
+}
+
+// ****************************************************************************
+// the hashed threshold calcs with the folded prefilter in front.  The bits of
+// either fingerprint that fold to a position the other's fold doesn't have
+// can't be in common, and there's at least one for every such position.
+template <typename Threshold ,
+          bool (*within)( const uint64_t * , int , const uint64_t * , int ,
+                          const Threshold & , double & ) ,
+          bool (*possible)( int , int , int , const Threshold & )>
+static int folded_threshold_distances( const FingerprintStore &fps ,
+                                       const uint64_t *q , int q_num ,
+                                       const uint64_t *q_fold , int q_fold_num ,
+                                       unsigned int start , unsigned int stop ,
+                                       const Threshold &threshold ,
+                                       int *hit_nums , double *hit_dists ,
+                                       size_t &num_pruned ) {
+
+  int fold_words = fps.fold_bits() / 64;
+  int num_hits = 0;
+  for( unsigned int j = start ; j < stop ; ++j ) {
+    int j_num = fps.num_bits_set( j );
+    int fold_in_common = popcount_and( fps.fold( j ) , q_fold , fold_words );
+    int max_in_common = min( j_num - fps.num_fold_bits_set( j ) ,
+                             q_num - q_fold_num ) + fold_in_common;
+    if( !possible( max_in_common , j_num , q_num , threshold ) ) {
+      ++num_pruned;
+      continue;
+    }
+    if( within( fps.bits( j ) , j_num , q , q_num , threshold ,
+                hit_dists[num_hits] ) ) {
+      hit_nums[num_hits] = j;
+      ++num_hits;
+    }
+  }
+
+  return num_hits;
+
+}
+
+// ****************************************************************************
+template <typename Row , typename Query ,
+          double (*calc)( const Row * , int , const Query * , int )>
+static void all_distances( const FingerprintStore &fps ,
+                           const Query *q , int q_num ,
+                           unsigned int start , unsigned int stop ,
+                           double *dists ) {
+
+  const Row *row_type = 0;
+  for( unsigned int j = start ; j < stop ; ++j ) {
+    dists[j - start] = calc( store_row( fps , j , row_type ) ,
+                             fps.num_bits_set( j ) , q , q_num );
+  }
+
+}
+
+// ****************************************************************************
+// the not-hashed threshold calcs, for plain or compact rows
+template <typename Row>
+static int not_hashed_threshold_distances( const FingerprintStore &fps ,
+                                           const uint32_t *q , int q_num ,
+                                           unsigned int start ,
+                                           unsigned int stop ,
+                                           double threshold , int *hit_nums ,
+                                           double *hit_dists ) {
+
+  switch( NotHashedFingerprint::similarity_calc() ) {
+  case TVERSKY :
+    return threshold_distances<Row , uint32_t , double ,
+                               &NotHashedFingerprint::tversky_within>( fps , q , q_num ,
+                                                                       start , stop , threshold ,
+                                                                       hit_nums , hit_dists );
+  case TANIMOTO : default :
+    return threshold_distances<Row , uint32_t , TanimotoThreshold ,
+                               &NotHashedFingerprint::tanimoto_within>( fps , q , q_num ,
+                                                                        start , stop ,
+                                                                        TanimotoThreshold( threshold ) ,
+                                                                        hit_nums , hit_dists );
+  }
+
+}
+
+// ****************************************************************************
+template <typename Row>
+static void not_hashed_all_distances( const FingerprintStore &fps ,
+                                      const uint32_t *q , int q_num ,
+                                      unsigned int start , unsigned int stop ,
+                                      double *dists ) {
+
+  switch( NotHashedFingerprint::similarity_calc() ) {
+  case TVERSKY :
+    all_distances<Row , uint32_t , &NotHashedFingerprint::tversky>( fps , q , q_num ,
+                                                                   start , stop , dists );
+    break;
+  case TANIMOTO : default :
+    all_distances<Row , uint32_t , &NotHashedFingerprint::tanimoto>( fps , q , q_num ,
+                                                                    start , stop , dists );
+    break;
+  }
+
+}
+
+// ****************************************************************************
+int FingerprintStore::calc_distances( const FingerprintStore &query_store ,
+                                      unsigned int query ,
+                                      unsigned int start , unsigned int stop ,
+                                      double threshold , int *hit_nums ,
+                                      double *hit_dists ,
+                                      size_t *num_pruned ) const {
+
+  if( hashed_ != query_store.hashed_ ) {
+    throw IncompatibleFingerprintError( "calc_distances" );
+  }
+
+  vector<uint32_t> q_nums;
+  return calc_distances( query_store.view( query , q_nums ) , start , stop ,
+                         threshold , hit_nums , hit_dists , num_pruned );
+
+}
+
+// ****************************************************************************
+int FingerprintStore::calc_distances( const FingerprintView &query ,
+                                      unsigned int start , unsigned int stop ,
+                                      double threshold , int *hit_nums ,
+                                      double *hit_dists ,
+                                      size_t *num_pruned ) const {
+
+  if( hashed_ != bool( query.bits_ ) ) {
+    throw IncompatibleFingerprintError( "calc_distances" );
+  }
+
+  int q_num = query.num_bits_set_;
+  if( hashed_ && fold_words_ && fold_words_ < num_words_ ) {
+    const uint64_t *q = query.bits_;
+    vector<uint64_t> q_fold( fold_words_ , uint64_t( 0 ) );
+    // a view's bits needn't be aligned
+    for( unsigned int k = 0 ; k < num_words_ ; ++k ) {
+      uint64_t w;
+      memcpy( &w , q + k , sizeof( w ) );
+      q_fold[k % fold_words_] |= w;
+    }
+    int q_fold_num = popcount_words( &q_fold[0] , fold_words_ );
+    size_t pruned = 0;
+    int num_hits = 0;
+    switch( HashedFingerprint::similarity_calc() ) {
+    case TVERSKY :
+      num_hits = folded_threshold_distances<double ,
+                                            &HashedFingerprint::tversky_within ,
+                                            &HashedFingerprint::tversky_possible>( *this , q , q_num ,
+                                                                                   &q_fold[0] , q_fold_num ,
+                                                                                   start , stop , threshold ,
+                                                                                   hit_nums , hit_dists ,
+                                                                                   pruned );
+      break;
+    case TANIMOTO : default :
+      num_hits = folded_threshold_distances<TanimotoThreshold ,
+                                            &HashedFingerprint::tanimoto_within ,
+                                            &HashedFingerprint::tanimoto_possible>( *this , q , q_num ,
+                                                                                    &q_fold[0] , q_fold_num ,
+                                                                                    start , stop ,
+                                                                                    TanimotoThreshold( threshold ) ,
+                                                                                    hit_nums , hit_dists ,
+                                                                                    pruned );
+      break;
+    }
+    if( num_pruned ) {
+      *num_pruned += pruned;
+    }
+    return num_hits;
+  }
+
+  if( hashed_ ) {
+    const uint64_t *q = query.bits_;
+    switch( HashedFingerprint::similarity_calc() ) {
+    case TVERSKY :
+      return threshold_distances<uint64_t , uint64_t , double ,
+                                 &HashedFingerprint::tversky_within>( *this , q , q_num ,
+                                                                      start , stop , threshold ,
+                                                                      hit_nums , hit_dists );
+    case TANIMOTO : default :
+      return threshold_distances<uint64_t , uint64_t , TanimotoThreshold ,
+                                 &HashedFingerprint::tanimoto_within>( *this , q , q_num ,
+                                                                       start , stop ,
+                                                                       TanimotoThreshold( threshold ) ,
+                                                                       hit_nums , hit_dists );
+    }
+  }
+
+  const uint32_t *q = query.frag_nums_;
+  if( compact_ ) {
+    return not_hashed_threshold_distances<unsigned char>( *this , q , q_num ,
+                                                          start , stop , threshold ,
+                                                          hit_nums , hit_dists );
+  }
+  return not_hashed_threshold_distances<uint32_t>( *this , q , q_num ,
+                                                   start , stop , threshold ,
+                                                   hit_nums , hit_dists );
+
+}
+
+// ****************************************************************************
+void FingerprintStore::calc_distances( const FingerprintStore &query_store ,
+                                       unsigned int query ,
+                                       unsigned int start , unsigned int stop ,
+                                       double *dists ) const {
+
+  if( hashed_ != query_store.hashed_ ) {
+    throw IncompatibleFingerprintError( "calc_distances" );
+  }
+
+  vector<uint32_t> q_nums;
+  calc_distances( query_store.view( query , q_nums ) , start , stop , dists );
+
+}
+
+// ****************************************************************************
+void FingerprintStore::calc_distances( const FingerprintView &query ,
+                                       unsigned int start , unsigned int stop ,
+                                       double *dists ) const {
+
+  if( hashed_ != bool( query.bits_ ) ) {
+    throw IncompatibleFingerprintError( "calc_distances" );
+  }
+
+  int q_num = query.num_bits_set_;
+  if( hashed_ ) {
+    const uint64_t *q = query.bits_;
+    switch( HashedFingerprint::similarity_calc() ) {
+    case TVERSKY :
+      all_distances<uint64_t , uint64_t , &HashedFingerprint::tversky>( *this , q , q_num ,
+                                                                       start , stop , dists );
+      break;
+    case TANIMOTO : default :
+      all_distances<uint64_t , uint64_t , &HashedFingerprint::tanimoto>( *this , q , q_num ,
+                                                                        start , stop , dists );
+      break;
+    }
+    return;
+  }
+
+  const uint32_t *q = query.frag_nums_;
+  if( compact_ ) {
+    not_hashed_all_distances<unsigned char>( *this , q , q_num , start , stop ,
+                                             dists );
+  } else {
+    not_hashed_all_distances<uint32_t>( *this , q , q_num , start , stop ,
+                                        dists );
+  }
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
@@ -0,0 +1,120 @@
+//
+// file FlushV2File.cc
+// 16th October 2026
+//
+
+#include "FlushV2File.H"
+#include "FileExceptions.H"
+#include "FingerprintKernels.H"
+#include "HashedFingerprint.H"
+#include "MagicInts.H"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// ****************************************************************************
+FlushV2Writer::FlushV2Writer( const string &filename , int num_chars_in_fp ) :
+  filename_( filename ) , fp_( 0 ) {
+
+  fp_ = fopen( filename.c_str() , "wb" );
+  if( !fp_ ) {
+    throw DACLIB::FileWriteOpenError( filename.c_str() );
+  }
+
+  memset( &header_ , 0 , sizeof( header_ ) );
+  header_.magic_ = FP2_MAGIC_INT;
+  header_.version_ = V2_VERSION;
+  header_.byte_order_ = V2_BYTE_ORDER;
+  header_.num_chars_ = num_chars_in_fp;
+  header_.bits_start_ = V2_BITS_START;
+
+  // the header goes in properly once the sizes are known
+  vector<char> space( V2_BITS_START , 0 );
+  write_bytes( &space[0] , space.size() );
+
+  row_.resize( HashedFingerprint::num_words() );
+  name_starts_.push_back( 0 );
+
+}
+
+// ****************************************************************************
+FlushV2Writer::~FlushV2Writer() {
+
+  if( fp_ ) {
+    finish();
+  }
+
+}
+
+// ****************************************************************************
+void FlushV2Writer::write_bytes( const void *bytes , size_t num_bytes ) {
+
+  if( num_bytes && 1 != fwrite( bytes , num_bytes , 1 , fp_ ) ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+void FlushV2Writer::write( const string &name ,
+                           const unsigned int *finger_bits ) {
+
+  fill( row_.begin() , row_.end() , uint64_t( 0 ) );
+  memcpy( &row_[0] , finger_bits ,
+          HashedFingerprint::num_ints() * sizeof( unsigned int ) );
+  write_bytes( &row_[0] , row_.size() * sizeof( uint64_t ) );
+
+  counts_.push_back( popcount_words( &row_[0] , row_.size() ) );
+  names_ += name;
+  name_starts_.push_back( names_.size() );
+
+}
+
+// ****************************************************************************
+void FlushV2Writer::write( const HashedFingerprint &fp ) {
+
+  write( fp.get_name() , fp.get_finger_bits() );
+
+}
+
+// ****************************************************************************
+void FlushV2Writer::finish() {
+
+  header_.num_fps_ = counts_.size();
+  header_.counts_start_ = header_.bits_start_
+      + header_.num_fps_ * row_.size() * sizeof( uint64_t );
+  write_bytes( counts_.empty() ? 0 : &counts_[0] ,
+               counts_.size() * sizeof( uint32_t ) );
+
+  uint64_t pos = header_.counts_start_ + counts_.size() * sizeof( uint32_t );
+  if( pos % sizeof( uint64_t ) ) {
+    uint32_t pad = 0;
+    write_bytes( &pad , sizeof( pad ) );
+    pos += sizeof( pad );
+  }
+  header_.name_starts_start_ = pos;
+  write_bytes( &name_starts_[0] , name_starts_.size() * sizeof( uint64_t ) );
+  header_.names_start_ = pos + name_starts_.size() * sizeof( uint64_t );
+  write_bytes( names_.data() , names_.size() );
+
+  if( fseek( fp_ , 0 , SEEK_SET ) ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  write_bytes( &header_ , sizeof( header_ ) );
+  if( fclose( fp_ ) ) {
+    cerr << "Error writing " << filename_ << "." << endl;
+    exit( 1 );
+  }
+  fp_ = 0;
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
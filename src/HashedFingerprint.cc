@@ -5,32 +5,114 @@
 // 29th January 2009
 //
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <new>
 #include <sstream>
+#include <typeinfo>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
 
 #include "ByteSwapper.H"
+#include "FingerprintKernels.H"
 #include "HashedFingerprint.H"
 
 using namespace std;
 
-#if defined(__GNUC__) && defined(__SSSE3__)
-#include "popcount_ssse3.cc"
-#elif defined(__GNUC__) && defined(__SSE2__)
-#include "popcount_ssse2.cc"
-#endif
 namespace DAC_FINGERPRINTS {
 
 pHDC HashedFingerprint::dist_calc_ = &HashedFingerprint::tanimoto;
 pHTDC HashedFingerprint::threshold_dist_calc_ = &HashedFingerprint::tanimoto;
+SIMILARITY_CALC HashedFingerprint::similarity_calc_ = TANIMOTO;
 unsigned int HashedFingerprint::num_ints_ = 0;
+unsigned int HashedFingerprint::num_words_ = 0;
+unsigned int HashedFingerprint::num_bits_ = 0;
 
 static const unsigned int BITS_PER_INT = 8 * sizeof( unsigned int );
 
+// the size of line, including the name, that write_ascii_line makes on the
+// stack.  Longer ones go on the heap.
+static const size_t ASCII_LINE_SIZE = 16384;
+
+// **************************************************************************
+// the name, then sep before each bit or a space before the lot if there's no
+// sep, made into one line and written in one go.
+template <typename FP>
+static void write_ascii_line( FP fp , const string &name ,
+                              const unsigned int *bits ,
+                              unsigned int num_ints , const string &sep ) {
+
+  size_t line_len = name.length() + 2
+      + size_t( num_ints ) * BITS_PER_INT * ( 1 + sep.length() );
+  char stack_line[ASCII_LINE_SIZE];
+  vector<char> heap_line;
+  char *line = stack_line;
+  if( line_len > ASCII_LINE_SIZE ) {
+    heap_line.resize( line_len );
+    line = &heap_line[0];
+  }
+
+  char *p = copy( name.begin() , name.end() , line );
+  if( sep.empty() ) {
+    *p++ = ' ';
+    unpack_bitstring( bits , num_ints , p );
+    p += size_t( num_ints ) * BITS_PER_INT;
+  } else {
+    char chars[BITS_PER_INT];
+    for( unsigned int i = 0 ; i < num_ints ; ++i ) {
+      unpack_bitstring( bits + i , 1 , chars );
+      for( unsigned int j = 0 ; j < BITS_PER_INT ; ++j ) {
+        p = copy( sep.begin() , sep.end() , p );
+        *p++ = chars[j];
+      }
+    }
+  }
+  *p++ = '\n';
+  write_text( fp , line , p - line );
+
+}
+
+// **************************************************************************
+// the fingerprint in hex, a tab and the name, made into one line and written
+// in one go.  num_bits is as for unpack_hex_fingerprint.
+template <typename FP>
+static void write_fps_line( FP fp , const string &name ,
+                            const unsigned int *bits , unsigned int num_ints ,
+                            unsigned int num_bits ) {
+
+  size_t line_len = size_t( num_ints ) * 2 * sizeof( unsigned int )
+      + name.length() + 2;
+  char stack_line[ASCII_LINE_SIZE];
+  vector<char> heap_line;
+  char *line = stack_line;
+  if( line_len > ASCII_LINE_SIZE ) {
+    heap_line.resize( line_len );
+    line = &heap_line[0];
+  }
+
+  char *p = line + unpack_hex_fingerprint( bits , num_ints , num_bits , line );
+  *p++ = '\t';
+  p = copy( name.begin() , name.end() , p );
+  *p++ = '\n';
+  write_text( fp , line , p - line );
+
+}
+
+// **************************************************************************
+// num_bits() if it fits fingerprints of num_ints ints, otherwise 0, for all
+// of them.
+static unsigned int known_num_bits( unsigned int num_bits ,
+                                    unsigned int num_ints ) {
+
+  return num_bits && ( num_bits + BITS_PER_INT - 1 ) / BITS_PER_INT == num_ints ?
+      num_bits : 0;
+
+}
+
 // **************************************************************************
 HashedFingerprint::HashedFingerprint() :
   FingerprintBase() , finger_bits_( 0 ) , num_bits_set_( 0 ) {
@@ -63,21 +145,21 @@ HashedFingerprint::HashedFingerprint( const string &name ,
   }
 
   if( !num_ints_ ) {
-    num_ints_ = new_num_ints;
+    set_num_ints( new_num_ints );
   }
 
   if( new_num_ints != num_ints_ ) {
     throw HashedFingerprintLengthError( num_ints_ , new_num_ints );
   }
 
-  finger_bits_ = new unsigned int[num_ints_];
+  finger_bits_ = alloc_finger_bits();
 
   int next_bit = 0;
   for( int i = num_ints_ - 1 ; i >= 0 ; --i , next_bit += 10 ) {
     finger_bits_[i] = boost::lexical_cast<unsigned int>( rep.substr( next_bit , 10 ) );
   }
 
-  count_bits();
+  recount_bits();
 
 }
 
@@ -87,11 +169,11 @@ HashedFingerprint::HashedFingerprint( const string &name ,
   FingerprintBase( name ) , finger_bits_( 0 ) , num_bits_set_( 0 ) {
 
   if( num_ints_ > 0 ) {
-    finger_bits_ = new unsigned int[num_ints_];
+    finger_bits_ = alloc_finger_bits();
     copy( new_ints , new_ints + num_ints_ , finger_bits_ );
   }
 
-  count_bits();
+  recount_bits();
 
 }
 
@@ -106,7 +188,7 @@ HashedFingerprint::HashedFingerprint( const HashedFingerprint &fp ) :
 // **************************************************************************
 HashedFingerprint::~HashedFingerprint() {
 
-  delete [] finger_bits_;
+  free_finger_bits( finger_bits_ );
 
 }
 
@@ -131,7 +213,7 @@ HashedFingerprint HashedFingerprint::operator&( const HashedFingerprint &rhs ) c
   for( unsigned int i = 0 ; i < HashedFingerprint::num_ints() ; ++i ) {
     ret_val.finger_bits_[i] = finger_bits_[i] & rhs.finger_bits_[i];
   }
-  ret_val.num_bits_set_ = 0; // to force a re-count if count_bits() is called
+  ret_val.recount_bits();
 
   return ret_val;
 
@@ -144,7 +226,7 @@ HashedFingerprint HashedFingerprint::operator|( const HashedFingerprint &rhs ) c
   for( unsigned int i = 0 ; i < HashedFingerprint::num_ints() ; ++i ) {
     ret_val.finger_bits_[i] = finger_bits_[i] | rhs.finger_bits_[i];
   }
-  ret_val.num_bits_set_ = 0; // to force a re-count if count_bits() is called
+  ret_val.recount_bits();
 
   return ret_val;
 
@@ -156,7 +238,7 @@ HashedFingerprint &HashedFingerprint::operator&=( const HashedFingerprint &rhs )
   for( unsigned int i = 0 ; i < num_ints_ ; ++i ) {
     finger_bits_[i] &= rhs.finger_bits_[i];
   }
-  num_bits_set_ = 0; // to force a re-count if count_bits() is called
+  recount_bits();
 
   return *this;
 
@@ -168,7 +250,7 @@ HashedFingerprint &HashedFingerprint::operator|=( const HashedFingerprint &rhs )
   for( unsigned int i = 0 ; i < num_ints_ ; ++i ) {
     finger_bits_[i] |= rhs.finger_bits_[i];
   }
-  num_bits_set_ = 0; // to force a re-count if count_bits() is called
+  recount_bits();
 
   return *this;
 
@@ -199,35 +281,25 @@ void HashedFingerprint::make_zero_fp( int num_bits ) {
   }
 
   if( !num_ints_ ) {
-    num_ints_ = new_num_ints;
+    set_num_ints( new_num_ints );
   }
 
   if( num_ints_ ) {
-    if( finger_bits_ && new_num_ints != num_ints_ ) {
-      delete [] finger_bits_;
-      finger_bits_ = 0;
-    }
     if( !finger_bits_ ) {
-      finger_bits_ = new unsigned int[num_ints_];
+      finger_bits_ = alloc_finger_bits();
+    } else {
+      std::fill_n( finger_bits_ , 2 * num_words_ , 0 );
     }
-    std::fill_n( finger_bits_ , num_ints_ , 0 );
   }
+  num_bits_set_ = 0;
 
 }
 
 // **************************************************************************
 double HashedFingerprint::tanimoto( const HashedFingerprint &f ) const {
 
-  if( !num_bits_set_ && !f.num_bits_set_ ) {
-    return 0.0; // otherwise, we'll get a NaN.
-  }
-
-  int num_in_common = num_bits_in_common( f );
-
-  double dist = 1.0 - ( double( num_in_common ) /
-                        double( num_bits_set_ + f.num_bits_set_ - num_in_common ));
-
-  return dist;
+  return tanimoto( get_finger_words() , num_bits_set_ ,
+                   f.get_finger_words() , f.num_bits_set_ );
 
 }
 
@@ -236,107 +308,175 @@ double HashedFingerprint::tanimoto( const HashedFingerprint &f ) const {
 double HashedFingerprint::tanimoto( const HashedFingerprint &f ,
                                     float threshold ) const {
 
-  float min_dist;
-  if( num_bits_set_ < f.num_bits_set_ ) {
-    min_dist = 1.0 - float( num_bits_set_ ) / float( f.num_bits_set_ );
+  return tanimoto( get_finger_words() , num_bits_set_ ,
+                   f.get_finger_words() , f.num_bits_set_ , threshold );
+
+}
+
+// **************************************************************************
+double HashedFingerprint::tversky( const HashedFingerprint &f ) const {
+
+  return tversky( get_finger_words() , num_bits_set_ ,
+                  f.get_finger_words() , f.num_bits_set_ );
+
+}
+
+// **************************************************************************
+// If the distance is predicted to be above the threshold, return 1.0.
+double HashedFingerprint::tversky( const HashedFingerprint &f ,
+                                   float threshold ) const {
+
+  return tversky( get_finger_words() , num_bits_set_ ,
+                  f.get_finger_words() , f.num_bits_set_ , threshold );
+
+}
+
+// **************************************************************************
+double HashedFingerprint::tanimoto( const uint64_t *a , int num_a ,
+                                    const uint64_t *b , int num_b ) {
+
+  return tanimoto_from_counts( popcount_and( a , b , num_words_ ) ,
+                               num_a , num_b );
+
+}
+
+// **************************************************************************
+// If the distance is above the threshold, return 1.0
+double HashedFingerprint::tanimoto( const uint64_t *a , int num_a ,
+                                    const uint64_t *b , int num_b ,
+                                    float threshold ) {
+
+  double dist;
+  if( tanimoto_within( a , num_a , b , num_b , TanimotoThreshold( threshold ) ,
+                       dist ) ) {
+    return dist;
   } else {
-    min_dist = 1.0 - float( f.num_bits_set_ ) / float( num_bits_set_ );
-  }
-  if( min_dist > threshold ) {
     return 1.0;
-  } else {
-    return tanimoto( f );
   }
 
 }
 
 // **************************************************************************
-double HashedFingerprint::tversky( const HashedFingerprint &f ) const {
+// the bit counts are checked first, as the distance can't be within the
+// threshold if it wouldn't be with all the bits of the smaller fingerprint
+// in the larger.
+bool HashedFingerprint::tanimoto_within( const uint64_t *a , int num_a ,
+                                         const uint64_t *b , int num_b ,
+                                         const TanimotoThreshold &threshold ,
+                                         double &dist ) {
+
+  if( !threshold.possible( num_a , num_b ) ) {
+    return false;
+  }
+  int num_in_common = popcount_and( a , b , num_words_ );
+  if( !threshold.accept( num_in_common , num_a , num_b ) ) {
+    return false;
+  }
+  dist = tanimoto_from_counts( num_in_common , num_a , num_b );
+  return true;
+
+}
 
-  int num_a_not_b , num_b_not_a;
+// **************************************************************************
+double HashedFingerprint::tanimoto_from_counts( int num_in_common , int num_a ,
+                                                int num_b ) {
 
-  int num_in_common = num_bits_in_common( f , num_a_not_b , num_b_not_a );
+  if( !num_a && !num_b ) {
+    return 0.0; // otherwise, we'll get a NaN.
+  }
 
   double dist = 1.0 - ( double( num_in_common ) /
-                        ( tversky_alpha_ * double( num_a_not_b ) +
-                          ( 1.0 - tversky_alpha_ ) * double( num_b_not_a )
-                          + double( num_in_common ) ) );
+                        double( num_a + num_b - num_in_common ));
 
   return dist;
 
 }
 
 // **************************************************************************
-double HashedFingerprint::tversky( const HashedFingerprint &f ,
-                                   float threshold __attribute__((unused)) ) const {
+double HashedFingerprint::tversky( const uint64_t *a , int num_a ,
+                                   const uint64_t *b , int num_b ) {
 
-  // don't have a calculation for the threshold, so just return the normal
-  // one
-  return tversky( f );
+  // |A & ~B| = |A| - |A & B|, so there's no need to count the other two
+  int num_in_common = popcount_and( a , b , num_words_ );
+
+  return tversky_from_counts( num_in_common , num_a - num_in_common ,
+                              num_b - num_in_common );
 
 }
 
-// ***************************************************************************
-int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ) const {
+// **************************************************************************
+// If the distance is predicted to be above the threshold, return 1.0.
+double HashedFingerprint::tversky( const uint64_t *a , int num_a ,
+                                   const uint64_t *b , int num_b ,
+                                   float threshold ) {
+
+  double dist;
+  if( tversky_within( a , num_a , b , num_b , threshold , dist ) ) {
+    return dist;
+  } else {
+    return 1.0;
+  }
 
-  static unsigned int *common_bits = 0;
-  if( !common_bits ) {
-    common_bits = new unsigned int[num_ints_];
+}
+
+// **************************************************************************
+// The Tversky similarity can't be better than it would be if all the bits in
+// the smaller fingerprint were also in the larger one, which only needs the
+// bit counts we already have.
+bool HashedFingerprint::tversky_within( const uint64_t *a , int num_a ,
+                                        const uint64_t *b , int num_b ,
+                                        const double &threshold ,
+                                        double &dist ) {
+
+  if( !tversky_possible( min( num_a , num_b ) , num_a , num_b , threshold ) ) {
+    return false;
   }
+  dist = tversky( a , num_a , b , num_b );
+  return dist <= threshold;
 
-  const unsigned int *these = finger_bits_ , *those = f.finger_bits_;
-  unsigned int *cb = common_bits;
+}
 
-  transform( these , these + num_ints_ , those , cb , std::bit_and<unsigned int>() );
+// **************************************************************************
+double HashedFingerprint::tversky_from_counts( int num_in_common ,
+                                               int num_a_not_b ,
+                                               int num_b_not_a ) {
 
-  return count_bits_set( common_bits , num_ints_ );
+  double dist = 1.0 - ( double( num_in_common ) /
+                        ( tversky_alpha_ * double( num_a_not_b ) +
+                          ( 1.0 - tversky_alpha_ ) * double( num_b_not_a )
+                          + double( num_in_common ) ) );
+
+  return dist;
 
 }
 
 // ***************************************************************************
-int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ,
-                                           int &num_in_a_not_b ,
-                                           int &num_in_b_not_a ) const {
+int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ) const {
 
-  static unsigned int *common_bits = 0 , *in_a_not_b = 0 , *in_b_not_a = 0;
-  if( !common_bits ) {
-    common_bits = new unsigned int[num_ints_];
-    in_a_not_b = new unsigned int[num_ints_];
-    in_b_not_a = new unsigned int[num_ints_];
-  }
+  return popcount_and( get_finger_words() , f.get_finger_words() ,
+                       num_words_ );
 
-  num_in_a_not_b = num_in_b_not_a = 0;
+}
 
-  unsigned int *cb = common_bits , *anb = in_a_not_b , *bna = in_b_not_a;
-  const unsigned int *these = finger_bits_ , *those = f.finger_bits_;
-  for( unsigned int i = 0 ; i < num_ints_ ; ++i , ++cb , ++anb , ++bna , ++these , ++those ) {
-    *cb = *these & *those;
-    *anb = *these & ( ~ *those );
-    *bna = *those & ( ~ *these );
-  }
+// ***************************************************************************
+int HashedFingerprint::num_bits_in_common( const HashedFingerprint &f ,
+                                           int &num_in_a_not_b ,
+                                           int &num_in_b_not_a ) const {
 
-  num_in_a_not_b = count_bits_set( in_a_not_b , num_ints_ );
-  num_in_b_not_a = count_bits_set( in_b_not_a , num_ints_ );
-  return count_bits_set( common_bits , num_ints_ );
+  int num_in_common = popcount_and( get_finger_words() , f.get_finger_words() ,
+                                    num_words_ );
+  // |A & ~B| = |A| - |A & B|, so there's no need to count the other two
+  num_in_a_not_b = count_bits() - num_in_common;
+  num_in_b_not_a = f.count_bits() - num_in_common;
+  return num_in_common;
 
 }
 
 // ***************************************************************************
 int HashedFingerprint::num_set_in_this_and_not_in_2( const HashedFingerprint &fp2 ) const {
 
-  static unsigned int *in_this_not_2 = 0;
-  if( !in_this_not_2 ) {
-    in_this_not_2 = new unsigned int[num_ints_];
-  }
-
-  unsigned int *itn2 = in_this_not_2;
-  const unsigned int *these = finger_bits_ , *those = fp2.finger_bits_;
-
-  for( unsigned int i = 0 ; i < num_ints_ ; ++i , ++itn2 , ++these , ++those ) {
-    *itn2 = *these & ( ~ *those );
-  }
-
-  return count_bits_set( in_this_not_2 , num_ints_ );
+  return popcount_andnot( get_finger_words() , fp2.get_finger_words() ,
+                          num_words_ );
 
 }
 
@@ -359,6 +499,7 @@ string HashedFingerprint::get_string_rep() const {
 // *************************************************************************
 void HashedFingerprint::set_similarity_calc( SIMILARITY_CALC sc ) {
 
+  similarity_calc_ = sc;
   switch( sc ) {
   case TANIMOTO :
     dist_calc_ = &HashedFingerprint::tanimoto;
@@ -373,17 +514,22 @@ void HashedFingerprint::set_similarity_calc( SIMILARITY_CALC sc ) {
 }
 
 // **************************************************************************
-// count the number of set bits in the fingerprint
+// the number of set bits in the fingerprint, which is kept up to date
+// whenever the bits change so there's nothing to work out here, and it's
+// safe to call from several threads at once.
 int HashedFingerprint::count_bits() const {
 
-  if( !num_bits_set_ ) {
-    num_bits_set_ = count_bits_set( finger_bits_ , num_ints_ );
-  }
-
   return num_bits_set_;
 
 }
 
+// **************************************************************************
+void HashedFingerprint::recount_bits() {
+
+  num_bits_set_ = finger_bits_ ? popcount_words( get_finger_words() , num_words_ ) : 0;
+
+}
+
 // **************************************************************************
 // calculate the distance between this fingerprint and the one passed in
 // using dist_calc_
@@ -443,6 +589,122 @@ double HashedFingerprint::calc_distance( const NotHashedFingerprint &f __attribu
 
 }
 
+// **************************************************************************
+// the fingerprints handed to the batch distance calcs are only known to be
+// FingerprintBases.  Checking the type this way doesn't involve a function
+// call, and they'll all be the same type in practice.
+static inline const HashedFingerprint &hashed_target( const FingerprintBase *fp ) {
+
+  if( typeid( *fp ) != typeid( HashedFingerprint ) ) {
+    throw IncompatibleFingerprintError( "calc_distances" );
+  }
+  return *static_cast<const HashedFingerprint *>( fp );
+
+}
+
+// **************************************************************************
+// the loops for the batch distance calcs, instantiated for each threshold
+// test so the calls are direct and can be inlined.  The distances are
+// calculated the same way round as calc_distance, i.e. the target is a and
+// fp is b, unless reverse is true.
+template <typename Threshold ,
+          bool (*within)( const uint64_t * , int , const uint64_t * , int ,
+                          const Threshold & , double & ) ,
+          bool reverse>
+static int threshold_distances( const HashedFingerprint &fp ,
+                                const FingerprintBase * const *targets ,
+                                int num_targets , const Threshold &threshold ,
+                                int *hit_nums , double *hit_dists ) {
+
+  const uint64_t *fp_bits = fp.get_finger_words();
+  int fp_num = fp.num_bits_set();
+
+  int num_hits = 0;
+  for( int j = 0 ; j < num_targets ; ++j ) {
+    const HashedFingerprint &target = hashed_target( targets[j] );
+    bool hit = reverse ?
+          within( fp_bits , fp_num , target.get_finger_words() ,
+                  target.num_bits_set() , threshold , hit_dists[num_hits] ) :
+          within( target.get_finger_words() , target.num_bits_set() ,
+                  fp_bits , fp_num , threshold , hit_dists[num_hits] );
+    if( hit ) {
+      hit_nums[num_hits] = j;
+      ++num_hits;
+    }
+  }
+
+  return num_hits;
+
+}
+
+// **************************************************************************
+template <pHDC calc>
+static void all_distances( const HashedFingerprint &fp ,
+                           const FingerprintBase * const *targets ,
+                           int num_targets , double *dists ) {
+
+  for( int j = 0 ; j < num_targets ; ++j ) {
+    dists[j] = ( hashed_target( targets[j] ).*calc )( fp );
+  }
+
+}
+
+// **************************************************************************
+int HashedFingerprint::calc_distances( const FingerprintBase * const *targets ,
+                                       int num_targets , double threshold ,
+                                       int *hit_nums , double *hit_dists ) const {
+
+  switch( similarity_calc_ ) {
+  case TVERSKY :
+    return threshold_distances<double , &HashedFingerprint::tversky_within ,
+                               false>( *this , targets , num_targets , threshold ,
+                                       hit_nums , hit_dists );
+  case TANIMOTO : default :
+    return threshold_distances<TanimotoThreshold , &HashedFingerprint::tanimoto_within ,
+                               false>( *this , targets , num_targets ,
+                                       TanimotoThreshold( threshold ) ,
+                                       hit_nums , hit_dists );
+  }
+
+}
+
+// **************************************************************************
+int HashedFingerprint::calc_reverse_distances( const FingerprintBase * const *targets ,
+                                               int num_targets , double threshold ,
+                                               int *hit_nums , double *hit_dists ) const {
+
+  switch( similarity_calc_ ) {
+  case TVERSKY :
+    return threshold_distances<double , &HashedFingerprint::tversky_within ,
+                               true>( *this , targets , num_targets , threshold ,
+                                      hit_nums , hit_dists );
+  case TANIMOTO : default :
+    // it's symmetrical, so there's no need for another version
+    return threshold_distances<TanimotoThreshold , &HashedFingerprint::tanimoto_within ,
+                               false>( *this , targets , num_targets ,
+                                       TanimotoThreshold( threshold ) ,
+                                       hit_nums , hit_dists );
+  }
+
+}
+
+// **************************************************************************
+void HashedFingerprint::calc_distances( const FingerprintBase * const *targets ,
+                                        int num_targets , double *dists ) const {
+
+  switch( similarity_calc_ ) {
+  case TVERSKY :
+    all_distances<&HashedFingerprint::tversky>( *this , targets , num_targets ,
+                                                dists );
+    break;
+  case TANIMOTO : default :
+    all_distances<&HashedFingerprint::tanimoto>( *this , targets , num_targets ,
+                                                 dists );
+    break;
+  }
+
+}
+
 // **************************************************************************
 bool HashedFingerprint::binary_read( gzFile fp , bool byte_swapping ) {
 
@@ -457,8 +719,7 @@ bool HashedFingerprint::binary_read( gzFile fp , bool byte_swapping ) {
   gzread( fp , &finger_name_[0] , name_len );
   gzread( fp , reinterpret_cast<void *>( finger_bits_ ) , num_ints_ * sizeof( unsigned int ) );
 
-  num_bits_set_ = 0; // to force a re-count
-  count_bits();
+  recount_bits();
 
   return true;
 
@@ -491,46 +752,51 @@ void HashedFingerprint::binary_write( FILE *fp ) const {
 bool HashedFingerprint::ascii_read( gzFile fp , const string &sep ) {
 
   // in FingerprintBase
-  string full_line = read_full_line( fp );
-  if( gzeof( fp ) && full_line.empty() ) {
+  string full_line;
+  if( !read_full_line( fp , full_line ) ) {
     return false;
   }
 
-  string name , rest;
-  // if sep is empty, split into 2 strings on space
-  if( sep.empty() ) {
-    size_t space_pos = full_line.find( ' ' );
-    if( string::npos == space_pos ) {
-      cerr << "Error reading fingerprint line : " << full_line << endl;
-      exit( 1 );
-    }
-    name = full_line.substr( 0 , space_pos );
-    rest = full_line.substr( space_pos + 1 );
-  } else {
-    // it's a bit more complicated. change sep to space, take out the 1st
-    // string as name, stick the rest back together again and proceed
-    // convert_sep_to_new_sep in FingerprintBase
-    string new_fl = convert_sep_to_new_sep( full_line , sep , " " );
-    size_t space_pos = new_fl.find( ' ' );
-    if( string::npos == space_pos ) {
-      cerr << "Error reading fingerprint line : " << full_line << endl;
-      exit( 1 );
+  // the name runs up to the first space or, if there is one, separator
+  size_t space_pos = full_line.find( ' ' );
+  if( !sep.empty() ) {
+    space_pos = min( space_pos , full_line.find( sep ) );
+  }
+  if( string::npos == space_pos ) {
+    cerr << "Error reading fingerprint line : " << full_line << endl;
+    exit( 1 );
+  }
+  string name = full_line.substr( 0 , space_pos );
+  const char *bitstring = full_line.data() + space_pos + 1;
+  size_t num_chars = full_line.length() - space_pos - 1;
+  string no_spaces;
+  if( !sep.empty() ) {
+    // only the spaces come out of the rest of the line, so anything else in
+    // it, separators included, counts as a 0.
+    no_spaces.reserve( num_chars );
+    for( size_t i = 0 ; i < num_chars ; ++i ) {
+      if( ' ' != bitstring[i] ) {
+        no_spaces += bitstring[i];
+      }
     }
-    name = full_line.substr( 0 , space_pos );
-    rest = convert_sep_to_new_sep( full_line.substr( space_pos + 1 ) , " " , "" );
+    bitstring = no_spaces.data();
+    num_chars = no_spaces.length();
   }
 
   // first time through, num_ints() should be zero, as we won't know at this
   // stage what we're dealing with.
   if( !num_ints() ) {
     try {
-      make_zero_fp( rest.length() );
+      make_zero_fp( num_chars );
     } catch( HashedFingerprintLengthError &e ) {
       cerr << "Caught : " << e.what() << endl;
       exit( 1 );
     }
   }
-  build_fp_from_bitstring( name , rest );
+  if( !num_bits_ ) {
+    set_num_bits( num_chars );
+  }
+  build_fp_from_bitstring( name , bitstring , num_chars );
 
   return true;
 
@@ -540,30 +806,7 @@ bool HashedFingerprint::ascii_read( gzFile fp , const string &sep ) {
 // write an ascii representation
 void HashedFingerprint::ascii_write( gzFile fp , const string &sep ) const {
 
-  static unsigned int *bit_masks = 0;
-  if( !bit_masks ) {
-    bit_masks = new unsigned int[BITS_PER_INT];
-    int b = 1 << (BITS_PER_INT - 1);
-    for( unsigned int i = 0 ; i < BITS_PER_INT ; ++i ) {
-      bit_masks[i] = b;
-      b >>= 1;
-    }
-  }
-
-  gzprintf( fp , "%s" , finger_name_.c_str() );
-  if( sep.empty() ) {
-    gzprintf( fp , " " );
-  }
-  for( unsigned int i = 0 ; i < num_ints_ ; ++i ) {
-    for( unsigned int j = 0 ; j < BITS_PER_INT ; ++j ) {
-      if( finger_bits_[i] & bit_masks[j] ) {
-        gzprintf( fp , "%s1" , sep.c_str() );
-      } else {
-        gzprintf( fp , "%s0" , sep.c_str() );
-      }
-    }
-  }
-  gzprintf( fp , "\n" );
+  write_ascii_line( fp , finger_name_ , finger_bits_ , num_ints_ , sep );
 
 }
 
@@ -571,34 +814,83 @@ void HashedFingerprint::ascii_write( gzFile fp , const string &sep ) const {
 // write an ascii representation
 void HashedFingerprint::ascii_write( FILE *fp , const string &sep ) const {
 
-#ifdef NOTYET
-  cout << "HashedFingerprint::ascii_write, num_ints_ = " << num_ints_ << endl;
-#endif
-
-  static unsigned int *bit_masks = 0;
-  if( !bit_masks ) {
-    bit_masks = new unsigned int[BITS_PER_INT];
-    unsigned int b = 1 << (BITS_PER_INT - 1);
-    for( unsigned int i = 0 ; i < BITS_PER_INT ; ++i ) {
-      bit_masks[i] = b;
-      b >>= 1;
+  write_ascii_line( fp , finger_name_ , finger_bits_ , num_ints_ , sep );
+
+}
+
+// **************************************************************************
+// read the next fingerprint from an FPS file
+bool HashedFingerprint::fps_read( gzFile fp ) {
+
+  static const string NUM_BITS_TAG( "#num_bits=" );
+  string full_line;
+  do {
+    if( !read_full_line( fp , full_line ) ) {
+      return false;
     }
+    if( !full_line.compare( 0 , NUM_BITS_TAG.length() , NUM_BITS_TAG ) ) {
+      set_num_bits( atoi( full_line.c_str() + NUM_BITS_TAG.length() ) );
+    }
+  } while( !full_line.empty() && '#' == full_line[0] );
+
+  size_t tab_pos = full_line.find( '\t' );
+  if( string::npos == tab_pos || tab_pos % 2 ) {
+    cerr << "Error reading FPS line : " << full_line << endl;
+    exit( 1 );
+  }
+  size_t name_end = full_line.find( '\t' , tab_pos + 1 );
+  if( string::npos == name_end ) {
+    name_end = full_line.length();
   }
 
-  fprintf( fp , "%s" , finger_name_.c_str() );
-  if( sep.empty() ) {
-    fprintf( fp , " " );
+  // the hex is whole bytes, so if the header said how many bits there are,
+  // it's only believed if it needs that many bytes.
+  unsigned int num_bits = 4 * tab_pos;
+  if( num_bits_ && 2 * ( ( num_bits_ + 7 ) / 8 ) == tab_pos ) {
+    num_bits = num_bits_;
   }
-  for( unsigned int i = 0 ; i < num_ints_ ; ++i ) {
-    for( unsigned int j = 0 ; j < BITS_PER_INT ; ++j ) {
-      if( finger_bits_[i] & bit_masks[j] ) {
-        fprintf( fp , "%s1" , sep.c_str() );
-      } else {
-        fprintf( fp , "%s0" , sep.c_str() );
-      }
+
+  // first time through, num_ints() should be zero, as we won't know at this
+  // stage what we're dealing with.
+  if( !num_ints() ) {
+    try {
+      make_zero_fp( num_bits );
+    } catch( HashedFingerprintLengthError &e ) {
+      cerr << "Caught : " << e.what() << endl;
+      exit( 1 );
     }
   }
-  fprintf( fp , "\n" );
+  unsigned int new_num_ints = calc_num_ints_req( num_bits );
+  if( new_num_ints != num_ints_ ) {
+    throw HashedFingerprintLengthError( new_num_ints , num_ints_ );
+  }
+
+  int num_set = pack_hex_fingerprint( full_line.data() , tab_pos , num_bits ,
+                                      finger_bits_ );
+  if( num_set < 0 ) {
+    cerr << "Error reading FPS line : " << full_line << endl;
+    exit( 1 );
+  }
+  num_bits_set_ = num_set;
+  finger_name_.assign( full_line , tab_pos + 1 , name_end - tab_pos - 1 );
+
+  return true;
+
+}
+
+// **************************************************************************
+void HashedFingerprint::fps_write( gzFile fp ) const {
+
+  write_fps_line( fp , finger_name_ , finger_bits_ , num_ints_ ,
+                  known_num_bits( num_bits_ , num_ints_ ) );
+
+}
+
+// **************************************************************************
+void HashedFingerprint::fps_write( FILE *fp ) const {
+
+  write_fps_line( fp , finger_name_ , finger_bits_ , num_ints_ ,
+                  known_num_bits( num_bits_ , num_ints_ ) );
 
 }
 
@@ -608,7 +900,7 @@ void HashedFingerprint::copy_data( const HashedFingerprint &fp ) {
   FingerprintBase::copy_data( fp );
 
   if( num_ints_ && !finger_bits_ ) {
-    finger_bits_ = new unsigned int[num_ints_];
+    finger_bits_ = alloc_finger_bits();
   }
   copy( fp.finger_bits_ , fp.finger_bits_ + num_ints_ , finger_bits_ );
 
@@ -620,65 +912,61 @@ void HashedFingerprint::copy_data( const HashedFingerprint &fp ) {
 void HashedFingerprint::build_fp_from_bitstring( const string &name ,
                                                  const string &bitstring ) {
 
+  build_fp_from_bitstring( name , bitstring.data() , bitstring.length() );
+
+}
+
+// **************************************************************************
+void HashedFingerprint::build_fp_from_bitstring( const string &name ,
+                                                 const char *bitstring ,
+                                                 size_t num_chars ) {
+
   finger_name_ = name;
-  unsigned int new_num_ints = calc_num_ints_req( bitstring.length() );
+  unsigned int new_num_ints = calc_num_ints_req( num_chars );
   if( num_ints_ && new_num_ints != num_ints_ ) {
     throw HashedFingerprintLengthError( new_num_ints , num_ints_ );
   }
   // obviously the bit string is the 'wrong way round' wrt least significant
-  // bit
+  // bit. It's padded at the front with 0s to an unsigned int boundary, which
+  // pack_bitstring does 32 characters at a time.
+  num_bits_set_ = pack_bitstring( bitstring , num_chars , finger_bits_ );
 
-  // make sure that there are an integral number of blocks of BITS_PER_INT
-  static string spare_bits;
-  if( spare_bits.empty() ) {
-    for( unsigned int i = 0 ; i < BITS_PER_INT ; ++i ) {
-      spare_bits += "0";
-    }
-  }
-  // need to pad the bitstring to an unsigned int boundary
-  int padding_needed = bitstring.length() % BITS_PER_INT;
-  if( padding_needed ) {
-    padding_needed = BITS_PER_INT - padding_needed;
-  }
-  string bits_to_use = padding_needed ?
-        spare_bits.substr( 0 , padding_needed ) + bitstring : bitstring;
-  num_bits_set_ = 0;
+}
 
-  static unsigned int *bit_masks = 0;
-  if( !bit_masks ) {
-    bit_masks = new unsigned int[BITS_PER_INT];
-    unsigned int b = 1 << (BITS_PER_INT - 1);
-    for( unsigned int i = 0 ; i < BITS_PER_INT ; ++i ) {
-      bit_masks[i] = b;
-      b >>= 1;
-    }
+// **************************************************************************
+// allocate space for num_words_ 64-bit words, aligned to a cache line so the
+// vector kernels never straddle one needlessly, and zero it so the padding
+// doesn't contribute to the bit counts.
+unsigned int *HashedFingerprint::alloc_finger_bits() {
+
+  size_t num_bytes = num_words_ * sizeof( uint64_t );
+  num_bytes = ( ( num_bytes + 63 ) / 64 ) * 64;
+  void *bits = 0;
+  if( posix_memalign( &bits , 64 , num_bytes ? num_bytes : 64 ) ) {
+    throw std::bad_alloc();
   }
+  std::fill_n( static_cast<unsigned char *>( bits ) , num_bytes , 0 );
 
-  for( unsigned int i = 0 , j = 0 ;
-       i < num_ints_ ; ++i , j += BITS_PER_INT ) {
-    string next_bits = bits_to_use.substr( j , BITS_PER_INT );
-    finger_bits_[i] = 0;
-    for( unsigned int l = BITS_PER_INT ; l > 0 ; --l ) {
-      if( '1' == next_bits[l-1] ) {
-        ++num_bits_set_;
-        finger_bits_[i] |= bit_masks[l-1];
-      }
-    }
+  return static_cast<unsigned int *>( bits );
 
-  }
+}
+
+// **************************************************************************
+void HashedFingerprint::free_finger_bits( unsigned int *bits ) {
+
+  free( bits );
 
 }
 
 // ****************************************************************************
 int count_bits_set( unsigned int *bits , int num_ints ) {
 
-#if defined(__GNUC__) && defined(__SSSE3__)
-  return popcount_ssse3( bits , num_ints );
-#elif defined(__GNUC__) && defined(__SSE2__)
-  return popcount_ssse2( bits , num_ints );
-#else
-  return 0;
-#endif
+  int cnt = popcount_words( reinterpret_cast<const uint64_t *>( bits ) ,
+                            num_ints / 2 );
+  if( num_ints % 2 ) {
+    cnt += __builtin_popcount( bits[num_ints - 1] );
+  }
+  return cnt;
 
 }
 
@@ -0,0 +1,352 @@
+//
+// file MappedFingerprintFile.cc
+// 16th October 2026
+//
+
+#include "MappedFingerprintFile.H"
+#include "FileExceptions.H"
+#include "FingerprintKernels.H"
+#include "HashedFingerprint.H"
+#include "MagicInts.H"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace DAC_FINGERPRINTS {
+
+// ****************************************************************************
+// the magic int and the fingerprint size in chars from the top of the file,
+// the latter being 0 for anything but a flush file.  False if there aren't
+// enough bytes for them.
+static bool read_file_header( const string &filename ,
+                              unsigned int &magic , int &num_chars ) {
+
+  FILE *fp = fopen( filename.c_str() , "rb" );
+  if( !fp ) {
+    return false;
+  }
+  bool ok = 1 == fread( &magic , sizeof( magic ) , 1 , fp );
+  num_chars = 0;
+  if( ok && FP_MAGIC_INT == magic ) {
+    ok = 1 == fread( &num_chars , sizeof( num_chars ) , 1 , fp );
+  } else if( ok && FP2_MAGIC_INT == magic ) {
+    FlushV2Header header;
+    ok = !fseek( fp , 0 , SEEK_SET )
+        && 1 == fread( &header , sizeof( header ) , 1 , fp );
+    num_chars = ok ? header.num_chars_ : 0;
+  }
+  fclose( fp );
+  return ok;
+
+}
+
+// ****************************************************************************
+static int num_ints_from_chars( int num_chars ) {
+
+  int num_ints = num_chars / sizeof( unsigned int );
+  if( num_chars % sizeof( unsigned int ) ) {
+    ++num_ints;
+  }
+  return num_ints;
+
+}
+
+// ****************************************************************************
+bool MappedFingerprintFile::mappable( const string &filename ,
+                                      FP_FILE_FORMAT format ) {
+
+  unsigned int magic;
+  int num_chars;
+  if( !read_file_header( filename , magic , num_chars ) ) {
+    return false;
+  }
+  // a gzipped file starts 0x1f 0x8b, so won't match any of them, and nor
+  // will a byte-swapped one.
+  if( FLUSH_FPS == format ) {
+    if( FP2_MAGIC_INT == magic ) {
+      return true;
+    }
+    return FP_MAGIC_INT == magic && num_chars > 0
+        && !( num_ints_from_chars( num_chars ) % 2 );
+  }
+  if( BIN_FRAG_NUMS == format ) {
+    return FN_MAGIC_INT == magic;
+  }
+  return false;
+
+}
+
+// ****************************************************************************
+bool MappedFingerprintFile::flush_v2( const string &filename ) {
+
+  unsigned int magic;
+  int num_chars;
+  return read_file_header( filename , magic , num_chars )
+      && ( FP2_MAGIC_INT == magic || BUGGERED_FP2_MAGIC_INT == magic );
+
+}
+
+// ****************************************************************************
+MappedFingerprintFile::MappedFingerprintFile( const string &filename ,
+                                              FP_FILE_FORMAT expected_format ,
+                                              ACCESS_PATTERN access ) :
+  filename_( filename ) , format_( expected_format ) , data_( 0 ) ,
+  size_( 0 ) , first_( 0 ) , pos_( 0 ) , v2_( false ) , row_bytes_( 0 ) ,
+  next_fp_( 0 ) , num_fps_( 0 ) {
+
+  unsigned int magic;
+  int num_chars;
+  if( !read_file_header( filename , magic , num_chars ) ) {
+    throw DACLIB::FileReadOpenError( filename.c_str() );
+  }
+  if( FLUSH_FPS == expected_format ) {
+    if( FP2_MAGIC_INT == magic ) {
+      v2_ = true;
+    } else if( FP_MAGIC_INT == magic ) {
+      first_ = 2 * sizeof( int );
+    } else {
+      throw FingerprintFileError( filename , expected_format ,
+                                  FN_MAGIC_INT == magic ?
+                                  "Binary Fragment Numbers" :
+                                  "compressed or byte-swapped" );
+    }
+    HashedFingerprint::set_num_ints( num_ints_from_chars( num_chars ) );
+  } else {
+    if( FN_MAGIC_INT != magic ) {
+      throw FingerprintFileError( filename , expected_format ,
+                                  FP_MAGIC_INT == magic || FP2_MAGIC_INT == magic ?
+                                  "Flush Fingerprints" :
+                                  "compressed or byte-swapped" );
+    }
+    first_ = sizeof( int );
+  }
+  pos_ = first_;
+
+  int fd = open( filename.c_str() , O_RDONLY );
+  if( fd < 0 ) {
+    throw DACLIB::FileReadOpenError( filename.c_str() );
+  }
+  struct stat st;
+  if( fstat( fd , &st ) ) {
+    close( fd );
+    throw DACLIB::FileReadOpenError( filename.c_str() );
+  }
+  size_ = st.st_size;
+  void *data = mmap( 0 , size_ , PROT_READ , MAP_PRIVATE , fd , 0 );
+  // the mapping keeps its own reference to the file
+  close( fd );
+  if( MAP_FAILED == data ) {
+    throw DACLIB::FileReadOpenError( filename.c_str() );
+  }
+  data_ = static_cast<const char *>( data );
+
+  if( v2_ ) {
+    try {
+      check_v2_header();
+    } catch( ... ) {
+      munmap( data , size_ );
+      throw;
+    }
+  }
+  advise( access );
+
+}
+
+// ****************************************************************************
+MappedFingerprintFile::~MappedFingerprintFile() {
+
+  munmap( const_cast<char *>( data_ ) , size_ );
+
+}
+
+// ****************************************************************************
+// make sure the sections the header describes are in order and inside the
+// file, so the views never point outside it.
+void MappedFingerprintFile::check_v2_header() {
+
+  memcpy( &header_ , data_ , sizeof( header_ ) );
+  row_bytes_ = HashedFingerprint::num_words() * sizeof( uint64_t );
+  num_fps_ = header_.num_fps_;
+
+  uint64_t n = header_.num_fps_;
+  // the starts are all checked against size_ before anything's added to
+  // them, so nothing can wrap round.
+  bool ok = V2_VERSION == header_.version_
+      && V2_BYTE_ORDER == header_.byte_order_ && header_.num_chars_
+      && header_.bits_start_ >= sizeof( header_ )
+      && header_.bits_start_ <= size_ && header_.counts_start_ <= size_
+      && header_.name_starts_start_ <= size_ && header_.names_start_ <= size_
+      && !( header_.bits_start_ % sizeof( uint64_t ) )
+      && n <= ( size_ - header_.bits_start_ ) / row_bytes_
+      && header_.counts_start_ >= header_.bits_start_ + n * row_bytes_
+      && !( header_.counts_start_ % sizeof( uint32_t ) )
+      && header_.counts_start_ + n * sizeof( uint32_t ) <= header_.name_starts_start_
+      && !( header_.name_starts_start_ % sizeof( uint64_t ) )
+      && header_.name_starts_start_ + ( n + 1 ) * sizeof( uint64_t ) <= header_.names_start_;
+  if( ok ) {
+    const uint64_t *name_starts =
+        reinterpret_cast<const uint64_t *>( data_ + header_.name_starts_start_ );
+    ok = !name_starts[0] && name_starts[n] <= size_ - header_.names_start_;
+    for( uint64_t i = 0 ; ok && i < n ; ++i ) {
+      ok = name_starts[i] <= name_starts[i + 1];
+    }
+  }
+  if( !ok ) {
+    throw FingerprintFileError( filename_ , FLUSH_FPS ,
+                                "damaged version 2 Flush Fingerprints" );
+  }
+
+}
+
+// ****************************************************************************
+void MappedFingerprintFile::advise( ACCESS_PATTERN access ) {
+
+  // only advice, so it doesn't matter if it's not taken
+  madvise( const_cast<char *>( data_ ) , size_ ,
+           SEQUENTIAL == access ? MADV_SEQUENTIAL : MADV_RANDOM );
+
+}
+
+// ****************************************************************************
+size_t MappedFingerprintFile::size() {
+
+  if( v2_ || num_fps_ ) {
+    return num_fps_;
+  }
+
+  size_t pos = pos_;
+  pos_ = first_;
+  FingerprintView fp;
+  while( next( fp ) ) {
+    ++num_fps_;
+  }
+  pos_ = pos;
+  return num_fps_;
+
+}
+
+// ****************************************************************************
+bool MappedFingerprintFile::read_int( int &val ) {
+
+  if( size_ - pos_ < sizeof( int ) ) {
+    return false;
+  }
+  memcpy( &val , data_ + pos_ , sizeof( int ) );
+  pos_ += sizeof( int );
+  return true;
+
+}
+
+// ****************************************************************************
+bool MappedFingerprintFile::next( FingerprintView &fp ) {
+
+  if( v2_ ) {
+    if( next_fp_ >= num_fps_ ) {
+      return false;
+    }
+    const uint64_t *name_starts =
+        reinterpret_cast<const uint64_t *>( data_ + header_.name_starts_start_ );
+    fp.name_ = data_ + header_.names_start_ + name_starts[next_fp_];
+    fp.name_len_ = name_starts[next_fp_ + 1] - name_starts[next_fp_];
+    fp.bits_ = reinterpret_cast<const uint64_t *>( data_ + header_.bits_start_
+                                                   + next_fp_ * row_bytes_ );
+    fp.frag_nums_ = 0;
+    fp.num_bits_set_ = reinterpret_cast<const uint32_t *>( data_ + header_.counts_start_ )[next_fp_];
+    ++next_fp_;
+    return true;
+  }
+
+  if( pos_ >= size_ ) {
+    return false;
+  }
+
+  int name_len;
+  if( !read_int( name_len ) || name_len < 0
+      || size_ - pos_ < size_t( name_len ) ) {
+    cerr << "Error : " << filename_ << " is truncated." << endl;
+    exit( 1 );
+  }
+  fp.name_ = data_ + pos_;
+  fp.name_len_ = name_len;
+  pos_ += name_len;
+
+  if( FLUSH_FPS == format_ ) {
+    size_t num_bytes = HashedFingerprint::num_words() * sizeof( uint64_t );
+    if( size_ - pos_ < num_bytes ) {
+      cerr << "Error : " << filename_ << " is truncated." << endl;
+      exit( 1 );
+    }
+    fp.bits_ = reinterpret_cast<const uint64_t *>( data_ + pos_ );
+    fp.frag_nums_ = 0;
+    fp.num_bits_set_ = popcount_words( fp.bits_ ,
+                                       HashedFingerprint::num_words() );
+    pos_ += num_bytes;
+  } else {
+    int num_frag_nums;
+    if( !read_int( num_frag_nums ) || num_frag_nums < 0
+        || ( size_ - pos_ ) / sizeof( uint32_t ) < size_t( num_frag_nums ) ) {
+      cerr << "Error : " << filename_ << " is truncated." << endl;
+      exit( 1 );
+    }
+    const char *nums = data_ + pos_;
+    if( reinterpret_cast<size_t>( nums ) % sizeof( uint32_t ) ) {
+      frag_nums_.resize( num_frag_nums );
+      if( num_frag_nums ) {
+        memcpy( &frag_nums_[0] , nums , num_frag_nums * sizeof( uint32_t ) );
+      }
+      fp.frag_nums_ = frag_nums_.empty() ? 0 : &frag_nums_[0];
+    } else {
+      fp.frag_nums_ = reinterpret_cast<const uint32_t *>( nums );
+    }
+    fp.bits_ = 0;
+    fp.num_bits_set_ = num_frag_nums;
+    pos_ += num_frag_nums * sizeof( uint32_t );
+  }
+
+  return true;
+
+}
+
+// ****************************************************************************
+void MappedFingerprintFile::seek( size_t i ) {
+
+  if( v2_ ) {
+    next_fp_ = i;
+    return;
+  }
+
+  pos_ = first_;
+  FingerprintView fp;
+  for( size_t j = 0 ; j < i && next( fp ) ; ++j ) {
+  }
+
+}
+
+// ****************************************************************************
+unsigned int MappedFingerprintFile::read_fps( unsigned int num_fps ,
+                                              FingerprintStore &fps ) {
+
+  FingerprintView fp;
+  unsigned int num_read = 0;
+  for( ; num_read < num_fps && next( fp ) ; ++num_read ) {
+    if( fp.bits_ ) {
+      fps.add_hashed( fp.name() ,
+                      reinterpret_cast<const unsigned int *>( fp.bits_ ) );
+    } else {
+      fps.add_not_hashed( fp.name() , fp.frag_nums_ , fp.num_bits_set_ );
+    }
+  }
+  return num_read;
+
+}
+
+} // end of namespace DAC_FINGERPRINTS
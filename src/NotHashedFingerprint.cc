@@ -5,10 +5,14 @@
 // 3rd February 2009
 //
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <set>
 #include <sstream>
+#include <typeinfo>
 
 #include <boost/lexical_cast.hpp>
 
@@ -23,6 +27,7 @@ namespace DAC_FINGERPRINTS {
   pNHDC NotHashedFingerprint::dist_calc_ = &NotHashedFingerprint::tanimoto;
   pNHTDC NotHashedFingerprint::threshold_dist_calc_ =
     &NotHashedFingerprint::tanimoto;
+  SIMILARITY_CALC NotHashedFingerprint::similarity_calc_ = TANIMOTO;
   
   // ****************************************************************************
   NotHashedFingerprint::NotHashedFingerprint() :
@@ -192,9 +197,8 @@ namespace DAC_FINGERPRINTS {
   // ****************************************************************************
   double NotHashedFingerprint::tanimoto( const NotHashedFingerprint &fp ) const {
 
-    int num_comm = num_bits_in_common( fp );
-    return( 1.0 - ( double( num_comm ) /
-		    double( num_frag_nums_ + fp.num_frag_nums_ - num_comm ) ) );
+    return tanimoto( frag_nums_ , num_frag_nums_ , fp.frag_nums_ ,
+		     fp.num_frag_nums_ );
 
   }
 
@@ -202,38 +206,223 @@ namespace DAC_FINGERPRINTS {
   double NotHashedFingerprint::tanimoto( const NotHashedFingerprint &f ,
 					 float thresh ) const {
     
-    float min_dist;
-    if( num_frag_nums_ < f.num_frag_nums_ )
-      min_dist = 1.0 - float( num_frag_nums_ ) / float( f.num_frag_nums_ );
-    else
-      min_dist = 1.0 - float( f.num_frag_nums_ ) / float( num_frag_nums_ );
-    if( min_dist > thresh ) {
-      return 1.0;
-    } else
-      return tanimoto( f );
+    return tanimoto( frag_nums_ , num_frag_nums_ , f.frag_nums_ ,
+		     f.num_frag_nums_ , thresh );
 
   }
 
   // ****************************************************************************
   double NotHashedFingerprint::tversky( const NotHashedFingerprint &f ) const {
 
-    int num_in_a_not_b , num_in_b_not_a;
-    int num_in_common = num_bits_in_common( f , num_in_a_not_b , num_in_b_not_a );
+    return tversky( frag_nums_ , num_frag_nums_ , f.frag_nums_ ,
+		    f.num_frag_nums_ );
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tversky( const NotHashedFingerprint &f ,
+                                        float thresh ) const {
+
+    return tversky( frag_nums_ , num_frag_nums_ , f.frag_nums_ ,
+		    f.num_frag_nums_ , thresh );
+
+  }
+
+  // ****************************************************************************
+  // the intersection counts for the calcs below, on plain and compact
+  // fragment numbers.
+  static inline int count_in_common( const uint32_t *a , int num_a ,
+				     const uint32_t *b , int num_b ,
+				     int min_count = 0 ) {
+    return intersect_count( a , num_a , b , num_b , min_count );
+  }
+  static inline int count_in_common( const unsigned char *a , int num_a ,
+				     const uint32_t *b , int num_b ,
+				     int min_count = 0 ) {
+    return intersect_count_compact( a , num_a , b , num_b , min_count );
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tanimoto( const uint32_t *a , int num_a ,
+					 const uint32_t *b , int num_b ) {
+
+    return tanimoto_t( a , num_a , b , num_b );
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tanimoto( const unsigned char *a , int num_a ,
+					 const uint32_t *b , int num_b ) {
+
+    return tanimoto_t( a , num_a , b , num_b );
+
+  }
+
+  // ****************************************************************************
+  template <typename A>
+  double NotHashedFingerprint::tanimoto_t( const A *a , int num_a ,
+					   const uint32_t *b , int num_b ) {
+
+    int num_comm = count_in_common( a , num_a , b , num_b );
+    return( 1.0 - ( double( num_comm ) /
+		    double( num_a + num_b - num_comm ) ) );
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tanimoto( const uint32_t *a , int num_a ,
+					 const uint32_t *b , int num_b ,
+					 float thresh ) {
     
-    double dist = 1.0 - ( double( num_in_common ) /
-			  ( tversky_alpha_ * double( num_in_a_not_b ) +
-			    ( 1.0 - tversky_alpha_ ) * double( num_in_b_not_a )
-			    + double( num_in_common ) ) ); 
+    double dist;
+    if( tanimoto_within( a , num_a , b , num_b , TanimotoThreshold( thresh ) ,
+			 dist ) ) {
+      return dist;
+    } else
+      return 1.0;
 
-    return dist;
+  }
+
+  // ****************************************************************************
+  bool NotHashedFingerprint::tanimoto_within( const uint32_t *a , int num_a ,
+					      const uint32_t *b , int num_b ,
+					      const TanimotoThreshold &threshold ,
+					      double &dist ) {
+
+    return tanimoto_within_t( a , num_a , b , num_b , threshold , dist );
 
   }
 
   // ****************************************************************************
-  double NotHashedFingerprint::tversky( const NotHashedFingerprint &f ,
-                                        float thresh __attribute__((unused)) ) const {
+  bool NotHashedFingerprint::tanimoto_within( const unsigned char *a , int num_a ,
+					      const uint32_t *b , int num_b ,
+					      const TanimotoThreshold &threshold ,
+					      double &dist ) {
 
-    return tversky( f );
+    return tanimoto_within_t( a , num_a , b , num_b , threshold , dist );
+
+  }
+
+  // ****************************************************************************
+  // the fragment counts are checked first, as the distance can't be within
+  // the threshold if it wouldn't be with all the fragments of the smaller
+  // fingerprint in the larger, and the intersection gives up as soon as it
+  // can't reach the number in common the threshold needs.  If they're both
+  // empty, the distance is a NaN, which isn't within anything.
+  template <typename A>
+  bool NotHashedFingerprint::tanimoto_within_t( const A *a , int num_a ,
+						const uint32_t *b , int num_b ,
+						const TanimotoThreshold &threshold ,
+						double &dist ) {
+
+    if( !num_a && !num_b ) {
+      return false;
+    }
+    if( !threshold.possible( num_a , num_b ) ) {
+      return false;
+    }
+    int num_comm = count_in_common( a , num_a , b , num_b ,
+				    threshold.min_in_common( num_a , num_b ) );
+    if( !threshold.accept( num_comm , num_a , num_b ) ) {
+      return false;
+    }
+    dist = 1.0 - ( double( num_comm ) / double( num_a + num_b - num_comm ) );
+    return true;
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tversky( const uint32_t *a , int num_a ,
+					const uint32_t *b , int num_b ) {
+
+    return tversky_t( a , num_a , b , num_b );
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tversky( const unsigned char *a , int num_a ,
+					const uint32_t *b , int num_b ) {
+
+    return tversky_t( a , num_a , b , num_b );
+
+  }
+
+  // ****************************************************************************
+  template <typename A>
+  double NotHashedFingerprint::tversky_t( const A *a , int num_a ,
+					  const uint32_t *b , int num_b ) {
+
+    int num_in_common = count_in_common( a , num_a , b , num_b );
+    return tversky_from_counts( num_in_common , num_a - num_in_common ,
+				num_b - num_in_common );
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tversky( const uint32_t *a , int num_a ,
+					const uint32_t *b , int num_b ,
+					float thresh __attribute__((unused)) ) {
+
+    return tversky( a , num_a , b , num_b );
+
+  }
+
+  // ****************************************************************************
+  bool NotHashedFingerprint::tversky_within( const uint32_t *a , int num_a ,
+					     const uint32_t *b , int num_b ,
+					     const double &threshold ,
+					     double &dist ) {
+
+    return tversky_within_t( a , num_a , b , num_b , threshold , dist );
+
+  }
+
+  // ****************************************************************************
+  bool NotHashedFingerprint::tversky_within( const unsigned char *a , int num_a ,
+					     const uint32_t *b , int num_b ,
+					     const double &threshold ,
+					     double &dist ) {
+
+    return tversky_within_t( a , num_a , b , num_b , threshold , dist );
+
+  }
+
+  // ****************************************************************************
+  template <typename A>
+  bool NotHashedFingerprint::tversky_within_t( const A *a , int num_a ,
+					       const uint32_t *b , int num_b ,
+					       const double &threshold ,
+					       double &dist ) {
+
+    // the denominator of the Tversky similarity is
+    // alpha * ( num_a - c ) + ( 1 - alpha ) * ( num_b - c ) + c, which is
+    // the same whatever c, the number in common, so the c needed can be
+    // worked out up front.  One less than that is asked for, in case of
+    // rounding, and the threshold is still decided on the distance itself.
+    double denom = tversky_alpha_ * double( num_a ) +
+      ( 1.0 - tversky_alpha_ ) * double( num_b );
+    int min_count = int( ceil( ( 1.0 - threshold ) * denom ) ) - 1;
+    int num_comm = count_in_common( a , num_a , b , num_b , min_count );
+    if( num_comm < min_count ) {
+      return false;
+    }
+    dist = tversky_from_counts( num_comm , num_a - num_comm ,
+				num_b - num_comm );
+    return dist <= threshold;
+
+  }
+
+  // ****************************************************************************
+  double NotHashedFingerprint::tversky_from_counts( int num_in_common ,
+						    int num_a_not_b ,
+						    int num_b_not_a ) {
+
+    double dist = 1.0 - ( double( num_in_common ) /
+			  ( tversky_alpha_ * double( num_a_not_b ) +
+			    ( 1.0 - tversky_alpha_ ) * double( num_b_not_a )
+			    + double( num_in_common ) ) );
+
+    return dist;
 
   }
 
@@ -297,28 +486,107 @@ namespace DAC_FINGERPRINTS {
 
   }
 
+  // the size of line, including the name, that write_ascii_line makes on the
+  // stack.  Longer ones go on the heap.
+  static const size_t ASCII_LINE_SIZE = 16384;
+  // the most characters a uint32_t takes in decimal
+  static const size_t MAX_FRAG_NUM_CHARS = 10;
+
+  // ****************************************************************************
+  // the name, then each number with sep, or a space if there's no sep, in
+  // front of it, made into one line and written in one go.
+  template <typename FP>
+  static void write_ascii_line( FP fp , const string &name ,
+                                const uint32_t *frag_nums , int num_frag_nums ,
+                                const string &sep ) {
+
+    const string act_sep = sep.empty() ? " " : sep;
+    size_t line_len = name.length() + 1
+        + size_t( num_frag_nums ) * ( act_sep.length() + MAX_FRAG_NUM_CHARS );
+    char stack_line[ASCII_LINE_SIZE];
+    vector<char> heap_line;
+    char *line = stack_line;
+    if( line_len > ASCII_LINE_SIZE ) {
+      heap_line.resize( line_len );
+      line = &heap_line[0];
+    }
+
+    char *p = copy( name.begin() , name.end() , line );
+    char digits[MAX_FRAG_NUM_CHARS];
+    for( int i = 0 ; i < num_frag_nums ; ++i ) {
+      p = copy( act_sep.begin() , act_sep.end() , p );
+      uint32_t fn = frag_nums[i];
+      char *d = digits + MAX_FRAG_NUM_CHARS;
+      do {
+        *--d = char( '0' + fn % 10 );
+        fn /= 10;
+      } while( fn );
+      p = copy( d , digits + MAX_FRAG_NUM_CHARS , p );
+    }
+    *p++ = '\n';
+    write_text( fp , line , p - line );
+
+  }
+
+  // ****************************************************************************
+  // the numbers from p up to end, each preceded by white space, and stopping
+  // at the first thing that isn't a number that fits in 32 bits, just as
+  // reading them from an istringstream does.
+  static void parse_frag_nums( const char *p , const char *end ,
+                               vector<uint32_t> &fns ) {
+
+    while( 1 ) {
+      while( p != end && isspace( static_cast<unsigned char>( *p ) ) ) {
+        ++p;
+      }
+      bool negative = false;
+      if( p != end && ( '+' == *p || '-' == *p ) ) {
+        negative = '-' == *p;
+        ++p;
+      }
+      if( p == end || !isdigit( static_cast<unsigned char>( *p ) ) ) {
+        return;
+      }
+      uint64_t next_fn = 0;
+      for( ; p != end && isdigit( static_cast<unsigned char>( *p ) ) ; ++p ) {
+        next_fn = 10 * next_fn + ( *p - '0' );
+        if( next_fn > 0xFFFFFFFFULL ) {
+          return;
+        }
+      }
+      fns.push_back( negative ? -uint32_t( next_fn ) : uint32_t( next_fn ) );
+    }
+
+  }
+
   // ****************************************************************************
   bool NotHashedFingerprint::ascii_read( gzFile fp , const string &sep ) {
 
     // in FingerprintBase.cc
-    string full_line = read_full_line( fp );
-    if( gzeof( fp ) && full_line.empty() ) {
+    string full_line;
+    if( !read_full_line( fp , full_line ) ) {
       return false;
     }
 
     full_line = convert_sep_to_new_sep( full_line , sep , " " );
-    istringstream iss( full_line );
-    iss >> finger_name_;
 
-    vector<uint32_t> fns;
-    while( 1 ) {
-      uint32_t next_fn;
-      iss >> next_fn;
-      if( iss.fail() ) {
-	break;
-      }
-      fns.push_back( next_fn );
+    // the name's the first word.  If there isn't one, it's left as it was,
+    // as reading it from an istringstream would.
+    const char *p = full_line.data();
+    const char *end = p + full_line.length();
+    while( p != end && isspace( static_cast<unsigned char>( *p ) ) ) {
+      ++p;
+    }
+    const char *name_start = p;
+    while( p != end && !isspace( static_cast<unsigned char>( *p ) ) ) {
+      ++p;
     }
+    if( p != name_start ) {
+      finger_name_.assign( name_start , p );
+    }
+
+    vector<uint32_t> fns;
+    parse_frag_nums( p , end , fns );
 
     build_from_vector( fns );
 
@@ -329,37 +597,14 @@ namespace DAC_FINGERPRINTS {
   // ****************************************************************************
   void NotHashedFingerprint::ascii_write( gzFile fp , const string &sep ) const {
 
-    string act_sep = sep.empty() ? " " : sep;
-    gzprintf( fp , "%s" , finger_name_.c_str() );
-
-    // cowardly skirting round of the issue of what format string to use for
-    // uint32_t in printf!  There seems to be a buffer size issue here,
-    // strings greater than 4K are being truncated, so write each frag_num_
-    // separately.
-    ostringstream oss;
-    for( int i = 0 ; i < num_frag_nums_ ; ++i ) {
-      oss << act_sep << frag_nums_[i];
-      gzprintf( fp , "%s" , oss.str().c_str() );
-      oss.str( "" );
-    }
-    gzprintf( fp , "\n" );
+    write_ascii_line( fp , finger_name_ , frag_nums_ , num_frag_nums_ , sep );
 
   }
 
   // ****************************************************************************
   void NotHashedFingerprint::ascii_write( FILE *fp , const string &sep ) const {
 
-    string act_sep = sep.empty() ? " " : sep;
-    fprintf( fp , "%s" , finger_name_.c_str() );
-    
-    // cowardly skirting round of the issue of what format chars to use for
-    // uint32_t in printf!
-    ostringstream oss;
-    for( int i = 0 ; i < num_frag_nums_ ; ++i ) {
-      oss << act_sep << frag_nums_[i];
-    }
-    fprintf( fp , "%s" , oss.str().c_str() );
-    fprintf( fp , "\n" );
+    write_ascii_line( fp , finger_name_ , frag_nums_ , num_frag_nums_ , sep );
 
   }
 
@@ -384,32 +629,8 @@ namespace DAC_FINGERPRINTS {
   // and this one
   int NotHashedFingerprint::num_bits_in_common( const NotHashedFingerprint &fp ) const {
 
-    // both sets of frag_nums are sorted, so can walk through them in sequence
-    uint32_t *these = frag_nums_ , *those = fp.frag_nums_;
-    uint32_t *these_stop = frag_nums_ + num_frag_nums_;
-    uint32_t *those_stop = fp.frag_nums_ + fp.num_frag_nums_;
-    int num_comm = 0;
-    while( these != these_stop && those != those_stop ) {
-      if( *these < *those ) {
-	while( these != these_stop && *these < *those ) {
-	  ++these;
-	}
-      } else {
-	while( those != those_stop && *those < *these ) {
-	  ++those;
-	} 
-      }
-      if( these == these_stop || those == those_stop ) {
-	break;
-      }
-      if( *these == *those ) {
-	++num_comm;
-	++these;
-	++those;
-      }
-    }
-
-    return num_comm;
+    return num_bits_in_common( frag_nums_ , num_frag_nums_ , fp.frag_nums_ ,
+			       fp.num_frag_nums_ );
 
   }
 
@@ -420,49 +641,30 @@ namespace DAC_FINGERPRINTS {
 						int &num_in_a_not_b ,
 						int &num_in_b_not_a ) const {
 
-    num_in_a_not_b = num_in_b_not_a = 0;
-
-    // both sets of frag_nums are sorted, so can walk through them in sequence
-    uint32_t *these = frag_nums_ , *those = fp.frag_nums_;
-    uint32_t *these_stop = frag_nums_ + num_frag_nums_;
-    uint32_t *those_stop = fp.frag_nums_ + fp.num_frag_nums_;
-    int num_comm = 0;
-    while( these != these_stop && those != those_stop ) {
-      // move these or those ( whichever has lower value) until they're equal
-      // or one hits the end
-      if( *these < *those ) {
-	while( *these < *those ) {
-	  ++these;
-	  ++those;
-	  ++num_in_a_not_b;
-	}
-      } else {
-	while( *those < *these ) {
-	  ++these;
-	  ++those;
-	  ++num_in_b_not_a;
-	}
-      }
-      if( those == those_stop ) {
-	while( these < these_stop ) {
-	  ++these;
-	  ++num_in_a_not_b;
-	}
-	break;
-      } 
-      if( these == these_stop ) {
-	while( those < those_stop ) {
-	  ++these;
-	  ++num_in_b_not_a;
-	}
-	break;
-      }
-      if( *those == *these ) {
-	++num_comm;
-      }
-      ++these;
-      ++those;
-    }
+    return num_bits_in_common( frag_nums_ , num_frag_nums_ , fp.frag_nums_ ,
+			       fp.num_frag_nums_ , num_in_a_not_b ,
+			       num_in_b_not_a );
+
+  }
+
+  // ****************************************************************************
+  int NotHashedFingerprint::num_bits_in_common( const uint32_t *a , int num_a ,
+						const uint32_t *b , int num_b ) {
+
+    return intersect_count( a , num_a , b , num_b );
+
+  }
+
+  // ****************************************************************************
+  // the ones not in common follow from the ones that are.
+  int NotHashedFingerprint::num_bits_in_common( const uint32_t *a , int num_a ,
+						const uint32_t *b , int num_b ,
+						int &num_in_a_not_b ,
+						int &num_in_b_not_a ) {
+
+    int num_comm = intersect_count( a , num_a , b , num_b );
+    num_in_a_not_b = num_a - num_comm;
+    num_in_b_not_a = num_b - num_comm;
 
     return num_comm;
 
@@ -471,6 +673,7 @@ namespace DAC_FINGERPRINTS {
   // *************************************************************************
   void NotHashedFingerprint::set_similarity_calc( SIMILARITY_CALC sc ) {
 
+    similarity_calc_ = sc;
     switch( sc ) {
       case TANIMOTO :
 	dist_calc_ = &NotHashedFingerprint::tanimoto;
@@ -543,6 +746,99 @@ namespace DAC_FINGERPRINTS {
   
   }
 
+  // ****************************************************************************
+  // as for HashedFingerprint, check the type without a function call.
+  static inline const NotHashedFingerprint &not_hashed_target( const FingerprintBase *fp ) {
+
+    if( typeid( *fp ) != typeid( NotHashedFingerprint ) ) {
+      throw IncompatibleFingerprintError( "calc_distances" );
+    }
+    return *static_cast<const NotHashedFingerprint *>( fp );
+
+  }
+
+  // ****************************************************************************
+  // the loops for the batch versions of calc_distance, instantiated for each
+  // threshold test as for HashedFingerprint.  The target is a and fp is b,
+  // unless reverse is true.
+  template <typename Threshold ,
+	    bool (*within)( const uint32_t * , int , const uint32_t * , int ,
+			    const Threshold & , double & ) ,
+	    bool reverse>
+  static int threshold_distances( const NotHashedFingerprint &fp ,
+				  const FingerprintBase * const *targets ,
+				  int num_targets , const Threshold &threshold ,
+				  int *hit_nums , double *hit_dists ) {
+
+    const uint32_t *fp_nums = fp.get_frag_nums();
+    int fp_num = fp.num_frag_nums();
+
+    int num_hits = 0;
+    for( int j = 0 ; j < num_targets ; ++j ) {
+      const NotHashedFingerprint &target = not_hashed_target( targets[j] );
+      bool hit = reverse ?
+	within( fp_nums , fp_num , target.get_frag_nums() ,
+		target.num_frag_nums() , threshold , hit_dists[num_hits] ) :
+	within( target.get_frag_nums() , target.num_frag_nums() ,
+		fp_nums , fp_num , threshold , hit_dists[num_hits] );
+      if( hit ) {
+	hit_nums[num_hits] = j;
+	++num_hits;
+      }
+    }
+
+    return num_hits;
+
+  }
+
+  // ****************************************************************************
+  int NotHashedFingerprint::calc_distances( const FingerprintBase * const *targets ,
+					    int num_targets , double threshold ,
+					    int *hit_nums , double *hit_dists ) const {
+
+    switch( similarity_calc_ ) {
+      case TVERSKY :
+	return threshold_distances<double , &NotHashedFingerprint::tversky_within ,
+				   false>( *this , targets , num_targets , threshold ,
+					   hit_nums , hit_dists );
+      case TANIMOTO : default :
+	return threshold_distances<TanimotoThreshold , &NotHashedFingerprint::tanimoto_within ,
+				   false>( *this , targets , num_targets ,
+					   TanimotoThreshold( threshold ) ,
+					   hit_nums , hit_dists );
+    }
+
+  }
+
+  // ****************************************************************************
+  int NotHashedFingerprint::calc_reverse_distances( const FingerprintBase * const *targets ,
+						    int num_targets , double threshold ,
+						    int *hit_nums , double *hit_dists ) const {
+
+    switch( similarity_calc_ ) {
+      case TVERSKY :
+	return threshold_distances<double , &NotHashedFingerprint::tversky_within ,
+				   true>( *this , targets , num_targets , threshold ,
+					  hit_nums , hit_dists );
+      case TANIMOTO : default :
+	return threshold_distances<TanimotoThreshold , &NotHashedFingerprint::tanimoto_within ,
+				   false>( *this , targets , num_targets ,
+					   TanimotoThreshold( threshold ) ,
+					   hit_nums , hit_dists );
+    }
+
+  }
+
+  // ****************************************************************************
+  void NotHashedFingerprint::calc_distances( const FingerprintBase * const *targets ,
+					     int num_targets , double *dists ) const {
+
+    for( int j = 0 ; j < num_targets ; ++j ) {
+      dists[j] = ( not_hashed_target( targets[j] ).*dist_calc_ )( *this );
+    }
+
+  }
+
   // ****************************************************************************
   void NotHashedFingerprint::copy_data( const NotHashedFingerprint &fp ) {
 
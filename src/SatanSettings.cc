@@ -30,7 +30,8 @@ void mpi_rec_string( int source_rank , string &str );
 SatanSettings::SatanSettings( int argc , char **argv ) :
   threshold_( 0.3 ) , min_count_( 0 ) , probe_chunk_size_( -1 ) ,
   tversky_alpha_( 0.5F ) ,
-  warm_feeling_( false ) , binary_file_( false ) ,
+  warm_feeling_( false ) , binary_file_( false ) , compact_frag_nums_( false ) ,
+  fold_bits_( 0 ) , num_threads_( 1 ) ,
   input_format_( FLUSH_FPS ) , sim_calc_( TANIMOTO ) ,
   input_format_string_( "FLUSH_FPS" ) , output_format_string_( "SATAN" ) ,
   sim_calc_string_( "TANIMOTO" ) {
@@ -82,6 +83,15 @@ bool SatanSettings::operator!() const {
     error_msg_ = string( "Invalid tversky_alpha " ) +
         boost::lexical_cast<string>( threshold_ ) + string( "." );
     return true;
+  } else if( fold_bits_ < 0 || fold_bits_ % 64 ) {
+    error_msg_ = string( "Invalid fold bits " ) +
+        boost::lexical_cast<string>( fold_bits_ ) +
+        string( ", must be a multiple of 64." );
+    return true;
+  } else if( num_threads_ < 1 ) {
+    error_msg_ = string( "Invalid number of threads " ) +
+        boost::lexical_cast<string>( num_threads_ ) + string( "." );
+    return true;
   }
 
   if( string( "SATAN" ) != output_format_string_ &&
@@ -112,6 +122,10 @@ void SatanSettings::send_contents_via_mpi( int dest_rank ) {
   MPI_Send( &i , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
   i = int( sim_calc_ );
   MPI_Send( &i , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  i = int( compact_frag_nums_ );
+  MPI_Send( &i , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  MPI_Send( &fold_bits_ , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
+  MPI_Send( &num_threads_ , 1 , MPI_INT , dest_rank , 0 , MPI_COMM_WORLD );
 
   DACLIB::mpi_send_string( input_format_string_ , dest_rank );
   DACLIB::mpi_send_string( bitstring_separator_ , dest_rank );
@@ -137,6 +151,10 @@ void SatanSettings::receive_contents_via_mpi() {
   input_format_ = static_cast<DAC_FINGERPRINTS::FP_FILE_FORMAT>( i );
   MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
   sim_calc_ = static_cast<DAC_FINGERPRINTS::SIMILARITY_CALC>( i );
+  MPI_Recv( &i , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  compact_frag_nums_ = static_cast<bool>( i );
+  MPI_Recv( &fold_bits_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  MPI_Recv( &num_threads_ , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
 
   DACLIB::mpi_rec_string( 0 , input_format_string_ );
   DACLIB::mpi_rec_string( 0 , bitstring_separator_ );
@@ -167,7 +185,7 @@ void SatanSettings::build_program_options( po::options_description &desc ) {
       ( "verbose,V" , po::value<bool>( &warm_feeling_ )->zero_tokens() ,
         "Verbose" )
       ( "input-format,F" , po::value<string>( &input_format_string_ ) ,
-        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
       ( "output-format" , po::value<string>( &output_format_string_ ) ,
         "Output format : SATAN|NNLISTS|COUNTS (default SATAN)" )
       ( "distance-calculation" , po::value<string>( &sim_calc_string_ ) ,
@@ -177,7 +195,13 @@ void SatanSettings::build_program_options( po::options_description &desc ) {
       ( "bitstring-separator" , po::value<string>( &bitstring_separator_ ) ,
         "For bitstrings input, the separator between bits (defaults to no separator)." )
       ( "frag-num-separator" , po::value<string>( &bitstring_separator_ ) ,
-        "For fragment numbers input, the separator between numbers (defaults to space)." );
+        "For fragment numbers input, the separator between numbers (defaults to space)." )
+      ( "compact-frag-nums" , po::value<bool>( &compact_frag_nums_ )->zero_tokens() ,
+        "For fragment numbers input, keep the probes' numbers compressed in memory, for big probe chunks at some cost in speed." )
+      ( "fold-bits" , po::value<int>( &fold_bits_ ) ,
+        "For hashed fingerprints, screen pairs with copies folded to this many bits (a multiple of 64, e.g. 256 or 512) before the full calculation.  Default 0, no screening." )
+      ( "num-threads" , po::value<int>( &num_threads_ ) ,
+        "Number of threads searching the targets, in each process of a parallel run, with one more reading them if it's more than 1 (default 1)." );
   
 }
 
@@ -124,12 +124,22 @@ int find_nearest_seed( double threshold , vector<FingerprintBase *> &cluster_see
                        const FingerprintBase &fp ) {
 
   int nearest_seed = -1;
+  if( cluster_seeds.empty() ) {
+    return nearest_seed;
+  }
+
+  // any seed nearer than the threshold will be in the hits, in seed order,
+  // so the first nearest is the same as checking them one at a time.
+  vector<int> hit_nums( cluster_seeds.size() );
+  vector<double> hit_dists( cluster_seeds.size() );
+  int num_hits = fp.calc_reverse_distances( &cluster_seeds[0] ,
+                                            cluster_seeds.size() , threshold ,
+                                            &hit_nums[0] , &hit_dists[0] );
   double nearest_dist = threshold;
-  for( int i = 0 , is = cluster_seeds.size() ; i < is ; ++i ) {
-    double dist = cluster_seeds[i]->calc_distance( fp , nearest_dist );
-    if( dist < nearest_dist ) {
-      nearest_seed = i;
-      nearest_dist = dist;
+  for( int i = 0 ; i < num_hits ; ++i ) {
+    if( hit_dists[i] < nearest_dist ) {
+      nearest_seed = hit_nums[i];
+      nearest_dist = hit_dists[i];
     }
   }
 
@@ -18,6 +18,7 @@
 
 #include "stddefs.H"
 #include "ClusterSettings.H"
+#include "FingerprintStore.H"
 #include "HashedFingerprint.H"
 #include "NotHashedFingerprint.H"
 #include "FileExceptions.H"
@@ -29,6 +30,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 using namespace boost;
 using namespace std;
@@ -81,16 +83,16 @@ void read_subset_file( const string &filename , vector<string> &subset_names ) {
 }
 
 // *******************************************************************************
-void apply_subset_names( const vector<string> &subset_names , vector<pFB> &fps ) {
+void apply_subset_names( const vector<string> &subset_names , FingerprintStore &fps ) {
 
-  int j = 0;
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    if( !binary_search( subset_names.begin() , subset_names.end() ,
-                        fps[i]->get_name() ) ) {
-      fps[j++] = fps[i];
+  vector<char> keep_fps( fps.size() , 1 );
+  for( unsigned int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    if( binary_search( subset_names.begin() , subset_names.end() ,
+                       fps.name( i ) ) ) {
+      keep_fps[i] = 0;
     }
   }
-  fps.erase( fps.begin() + j , fps.end() );
+  fps.keep( keep_fps );
 
 }
 
@@ -166,86 +168,286 @@ void read_fp_file( ClusterSettings cs , const vector<string> &seed_names ,
 }
 
 // *******************************************************************************
-void fps_to_name( vector<pFB> &fps , vector<string> &fp_names ) {
+void apply_subset( ClusterSettings &cs , FingerprintStore &fps ) {
 
-  fp_names.reserve( fps.size() );
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    fp_names.push_back( fps[i]->get_name() );
+  if( !cs.subset_file().empty() ) {
+    vector<string> subset_names;
+    read_subset_file( cs.subset_file() , subset_names );
+    apply_subset_names( subset_names , fps );
   }
-  fps.clear();
 
 }
 
 // *******************************************************************************
-void apply_subset( ClusterSettings &cs , vector<pFB> &fps ) {
-
-  if( !cs.subset_file().empty() ) {
-    vector<string> subset_names;
-    read_subset_file( cs.subset_file() , subset_names );
-    apply_subset_names( subset_names , fps );
+// split the num_fps rows of the upper triangle of the distance matrix between
+// num_slaves slaves, slave i getting rows block_starts[i] to
+// block_starts[i + 1] - 1.  Row i has num_fps - 1 - i pairs in it, so the
+// blocks get longer further down, to keep the number of pairs about even.
+void triangle_blocks( unsigned int num_fps , int num_slaves ,
+                      vector<unsigned int> &block_starts ) {
+
+  block_starts = vector<unsigned int>( num_slaves + 1 , num_fps );
+  block_starts[0] = 0;
+
+  double n = num_fps;
+  double num_pairs = 0.5 * n * ( n - 1.0 );
+  for( int i = 1 ; i < num_slaves ; ++i ) {
+    double target = num_pairs * i / num_slaves;
+    // the first row with at least target pairs in the rows before it
+    unsigned int lo = block_starts[i - 1] , hi = num_fps;
+    while( lo < hi ) {
+      unsigned int mid = lo + ( hi - lo ) / 2;
+      double m = mid;
+      if( m * ( n - 1.0 ) - 0.5 * m * ( m - 1.0 ) < target ) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    block_starts[i] = lo;
   }
 
 }
 
 // *******************************************************************************
-void make_nnlists( bool warm_feeling , double threshold ,
-                   unsigned int start_num , unsigned int stop_num ,
-                   const vector<pFB> &fps ,
-                   vector<vector<int> > &nns ) {
+// hands out the rows of the distance matrix to the threads of make_nbs_lists
+// a few at a time, as they ask for them.  The rows get shorter going down the
+// triangle and the number of hits in them varies a lot, so splitting them up
+// evenly beforehand would leave some threads idle long before the others.
+class RowChunks {
+
+public :
+
+  RowChunks( unsigned int start_row , unsigned int stop_row ,
+             bool warm_feeling ) :
+    start_row_( start_row ) , next_row_( start_row ) , stop_row_( stop_row ) ,
+    chunk_size_( 16 ) , warm_feeling_( warm_feeling ) {}
+
+  // the next rows to do, start to stop - 1. Returns false when there are
+  // none left.
+  bool next_chunk( unsigned int &start , unsigned int &stop ) {
+    boost::mutex::scoped_lock lock( mutex_ );
+    if( next_row_ >= stop_row_ ) {
+      return false;
+    }
+    start = next_row_;
+    stop = min( stop_row_ , next_row_ + chunk_size_ );
+    next_row_ = stop;
+    if( warm_feeling_ && ( start - start_row_ ) / 1000 != ( stop - start_row_ ) / 1000 ) {
+      cout << "Started " << stop - start_row_ << " rows of the distance matrix."
+           << endl;
+    }
+    return true;
+  }
+
+private :
+
+  unsigned int start_row_ , next_row_ , stop_row_ , chunk_size_;
+  bool warm_feeling_;
+  boost::mutex mutex_;
+
+};
+
+// *******************************************************************************
+// one thread's share of make_nbs_lists.  It searches the rows it gets from
+// chunks against the fps after them, putting the hits in hit_nums as (i, j)
+// with the distances in hit_dists.
+class TriangleSearcher {
+
+public :
+
+  TriangleSearcher( const FingerprintStore &fps , double threshold ,
+                    RowChunks &chunks ) :
+    fps_( &fps ) , threshold_( threshold ) , chunks_( &chunks ) ,
+    num_pruned_( 0 ) {}
+
+  void operator()() {
+    vector<int> row_nums( fps_->size() );
+    vector<double> row_dists( fps_->size() );
+    unsigned int start , stop;
+    while( chunks_->next_chunk( start , stop ) ) {
+      for( unsigned int i = start ; i < stop ; ++i ) {
+        int num_hits = fps_->calc_distances( *fps_ , i , i + 1 , fps_->size() ,
+                                             threshold_ , &row_nums[0] ,
+                                             &row_dists[0] , &num_pruned_ );
+        for( int k = 0 ; k < num_hits ; ++k ) {
+          if( row_dists[k] < threshold_ ) {
+            hit_nums_.push_back( i );
+            hit_nums_.push_back( row_nums[k] );
+            hit_dists_.push_back( row_dists[k] );
+          }
+        }
+      }
+    }
+  }
+
+  vector<int> &hit_nums() { return hit_nums_; }
+  vector<float> &hit_dists() { return hit_dists_; }
+  size_t num_pruned() const { return num_pruned_; }
+
+private :
+
+  const FingerprintStore *fps_;
+  double threshold_;
+  RowChunks *chunks_;
+  vector<int> hit_nums_;
+  vector<float> hit_dists_;
+  size_t num_pruned_;
+
+};
+
+// *******************************************************************************
+// the neighbours of fps start_num to stop_num - 1, as (fp, distance) with the
+// fp itself first.  The distance is symmetrical, so each pair is only done
+// once, from the upper triangle of the distance matrix, and the hit goes in
+// both lists.  Hits for fps at stop_num or beyond, which are another slave's
+// in a parallel run, go in far_nums as (j, i), meaning i is a neighbour of j,
+// with the distance in far_dists.
+// The rows are shared between num_threads threads, and their hits merged
+// afterwards in thread order.  The order the hits go into a list doesn't
+// matter, as they're sorted by distance and then fp number in the end, so
+// the lists are the same however the rows were shared out.
+void make_nbs_lists( bool warm_feeling , double threshold , int num_threads ,
+                     unsigned int start_num , unsigned int stop_num ,
+                     const FingerprintStore &fps ,
+                     vector<vector<pair<int,float> > > &nbs ,
+                     vector<int> &far_nums , vector<float> &far_dists ) {
 
-  stop_num = stop_num > fps.size() ? fps.size() : stop_num;
   if( warm_feeling ) {
     cout << "Creating neighbour lists for fps " << start_num
-         << " to " << stop_num << endl;
+         << " to " << stop_num << " with " << num_threads << " thread"
+         << ( num_threads > 1 ? "s" : "" ) << endl;
   }
 
-  for( unsigned int i = start_num ; i < stop_num ; ++i ) {
+  RowChunks chunks( start_num , stop_num , warm_feeling );
+  vector<TriangleSearcher> searchers( num_threads ,
+                                      TriangleSearcher( fps , threshold , chunks ) );
+  if( 1 == num_threads ) {
+    searchers.front()();
+  } else {
+    boost::thread_group threads;
+    for( int i = 0 ; i < num_threads ; ++i ) {
+      threads.create_thread( boost::ref( searchers[i] ) );
+    }
+    threads.join_all();
+  }
 
-    vector<pair<int,float> > nbs;
-    nbs.push_back( make_pair( i , 0.0F ) );
-    for( unsigned int j = 0 , js = fps.size() ; j < js ; ++j ) {
-      if( i == j ) {
-        continue;
-      }
-      double dist = fps[i]->calc_distance( *fps[j] , threshold );
-      if( dist < threshold ) {
-        nbs.push_back( make_pair( j , dist ) );
+  nbs = vector<vector<pair<int,float> > >( stop_num - start_num );
+  for( unsigned int i = start_num ; i < stop_num ; ++i ) {
+    nbs[i - start_num].push_back( make_pair( i , 0.0F ) );
+  }
+
+  size_t num_pruned = 0;
+  for( int t = 0 ; t < num_threads ; ++t ) {
+    vector<int> &hit_nums = searchers[t].hit_nums();
+    vector<float> &hit_dists = searchers[t].hit_dists();
+    for( unsigned int k = 0 , ks = hit_dists.size() ; k < ks ; ++k ) {
+      unsigned int i = hit_nums[2 * k] , j = hit_nums[2 * k + 1];
+      nbs[i - start_num].push_back( make_pair( j , hit_dists[k] ) );
+      if( j < stop_num ) {
+        nbs[j - start_num].push_back( make_pair( i , hit_dists[k] ) );
+      } else {
+        far_nums.push_back( j );
+        far_nums.push_back( i );
+        far_dists.push_back( hit_dists[k] );
       }
     }
-    if( nbs.size() > 1 ) {
-      sort( nbs.begin() + 1 , nbs.end() , SortNbsByDist() );
-    }
-    nns.push_back( vector<int>() );
-    transform( nbs.begin() , nbs.end() , back_inserter( nns.back() ) ,
-               bind( &pair<int,float>::first , _1 ) );
-    if( warm_feeling && (i - start_num) && !( ( i-start_num ) % 1000 ) ) {
-      cout << "Generated " << i - start_num << " near-neighbour lists."
-           << endl;
+    vector<int>().swap( hit_nums );
+    vector<float>().swap( hit_dists );
+    num_pruned += searchers[t].num_pruned();
+  }
+
+  if( warm_feeling && fps.hashed() && fps.fold_bits() ) {
+    size_t num_pairs = 0;
+    for( unsigned int i = start_num ; i < stop_num ; ++i ) {
+      num_pairs += fps.size() - i - 1;
     }
+    cout << "Folded prefilter ruled out " << num_pruned << " of "
+         << num_pairs << " pairs." << endl;
+  }
 
+}
+
+// *******************************************************************************
+// send the hits make_nbs_lists found for other slaves' fps to the slaves
+// concerned, and add the ones the other slaves found for this one's to nbs.
+// The hits only ever go down the triangle, so this slave sends to the slaves
+// after it and hears from the ones before.  The messages are sent with tag 1
+// so they can't be confused with anything from the master.
+void exchange_far_hits( int slave_num , const vector<unsigned int> &block_starts ,
+                        const vector<int> &far_nums ,
+                        const vector<float> &far_dists ,
+                        vector<vector<pair<int,float> > > &nbs ) {
+
+  int num_slaves = block_starts.size() - 1;
+  vector<vector<int> > send_nums( num_slaves );
+  vector<vector<float> > send_dists( num_slaves );
+  for( unsigned int k = 0 , ks = far_dists.size() ; k < ks ; ++k ) {
+    unsigned int j = far_nums[2 * k];
+    int dest = upper_bound( block_starts.begin() , block_starts.end() , j ) -
+        block_starts.begin() - 1;
+    send_nums[dest].push_back( j );
+    send_nums[dest].push_back( far_nums[2 * k + 1] );
+    send_dists[dest].push_back( far_dists[k] );
+  }
+
+  // everything goes off at once, even if it's empty, so the slaves can't
+  // hold each other up.  Slave i is process i + 1.
+  vector<MPI_Request> requests;
+  for( int i = slave_num + 1 ; i < num_slaves ; ++i ) {
+    requests.push_back( MPI_Request() );
+    MPI_Isend( send_nums[i].empty() ? 0 : &send_nums[i][0] ,
+               send_nums[i].size() , MPI_INT , i + 1 , 1 , MPI_COMM_WORLD ,
+               &requests.back() );
+    requests.push_back( MPI_Request() );
+    MPI_Isend( send_dists[i].empty() ? 0 : &send_dists[i][0] ,
+               send_dists[i].size() , MPI_FLOAT , i + 1 , 1 , MPI_COMM_WORLD ,
+               &requests.back() );
+  }
+
+  unsigned int start_fp = block_starts[slave_num];
+  vector<int> rec_nums;
+  vector<float> rec_dists;
+  for( int i = 0 ; i < slave_num ; ++i ) {
+    MPI_Status status;
+    MPI_Probe( MPI_ANY_SOURCE , 1 , MPI_COMM_WORLD , &status );
+    int num_ints;
+    MPI_Get_count( &status , MPI_INT , &num_ints );
+    rec_nums.resize( num_ints + 1 );
+    rec_dists.resize( num_ints / 2 + 1 );
+    MPI_Recv( &rec_nums[0] , num_ints , MPI_INT , status.MPI_SOURCE , 1 ,
+              MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+    MPI_Recv( &rec_dists[0] , num_ints / 2 , MPI_FLOAT , status.MPI_SOURCE , 1 ,
+              MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+    for( int k = 0 ; k < num_ints / 2 ; ++k ) {
+      nbs[rec_nums[2 * k] - start_fp].push_back( make_pair( rec_nums[2 * k + 1] ,
+                                                             rec_dists[k] ) );
+    }
   }
 
-  if( warm_feeling ) {
-    cout << "Generated all " << stop_num - start_num << " near-neighbour lists."
-         << endl;
+  if( !requests.empty() ) {
+    MPI_Waitall( requests.size() , &requests[0] , MPI_STATUSES_IGNORE );
   }
 
 }
 
 // *******************************************************************************
-void check_for_spaces_in_fp_names( bool fix_spaces , vector<pFB> &fps ) {
-
-  for( unsigned int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    if( string::npos != fps[i]->get_name().find( ' ' ) ) {
-      if( !fix_spaces ) {
-        cout << "Fingerprint " << i << " name " << fps[i]->get_name()
-             << " has space(s) in its name.  Either use output format CSV"
-             << " or --fix-spaces-in-names" << endl;
-        exit( 1 );
-      } else {
-        fps[i]->set_name( fix_spaces_in_fp_name( fps[i]->get_name() , true ) );
-      }
+// sort the neighbours after the fp itself into ascending order of distance,
+// and put the neighbour lists of fp numbers on the end of nns.  nbs is
+// emptied as it goes, to give the memory back.
+void nbs_to_nnlists( vector<vector<pair<int,float> > > &nbs ,
+                     vector<vector<int> > &nns ) {
+
+  nns.reserve( nns.size() + nbs.size() );
+  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    if( nbs[i].size() > 2 ) {
+      sort( nbs[i].begin() + 1 , nbs[i].end() , SortNbsByDist() );
     }
+    nns.push_back( vector<int>() );
+    nns.back().reserve( nbs[i].size() );
+    transform( nbs[i].begin() , nbs[i].end() , back_inserter( nns.back() ) ,
+               bind( &pair<int,float>::first , _1 ) );
+    vector<pair<int,float> >().swap( nbs[i] );
   }
 
 }
@@ -269,47 +471,56 @@ void check_for_spaces_in_fp_names( bool fix_spaces , vector<string> &fp_names )
 }
 
 // *******************************************************************************
-void make_nnlists( ClusterSettings &cs , unsigned int start_fp ,
-                   unsigned int &num_fps_to_do , vector<string> &fp_names ,
-                   vector<vector<int> > &nns ) {
-
-  gzFile gzfp;
-  bool byteswapping;
-  open_fp_file( cs.input_file() , cs.input_format() , byteswapping , gzfp );
+// make the nnlists for slave slave_num of num_slaves, which is 0 of 1 for a
+// serial run.  start_fp and num_fps_to_do are set to the fps it's done.
+void make_nnlists( ClusterSettings &cs , int slave_num , int num_slaves ,
+                   unsigned int &start_fp , unsigned int &num_fps_to_do ,
+                   vector<string> &fp_names , vector<vector<int> > &nns ) {
 
   // read all the fps from the file, which we'll need even if we're only
   // doing a portion of the nnlists
-  vector<FingerprintBase *> raw_fps;
-  read_fps_from_file( gzfp , byteswapping , cs.input_format() , cs.bitstring_separator() ,
-                      0 , numeric_limits<unsigned int>::max() , raw_fps );
-
-  vector<pFB> fps;
-  fps.reserve( raw_fps.size() );
-  for( int i = 0 , is = raw_fps.size() ; i < is ; ++i ) {
-    fps.push_back( pFB( raw_fps[i] ) );
+  FingerprintStore fps( cs.compact_frag_nums() );
+  try {
+    read_fp_file( cs.input_file() , cs.input_format() ,
+                  cs.bitstring_separator() , fps );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
   }
   apply_subset( cs , fps );
+  fps.set_fold_bits( cs.fold_bits() );
 
+  fps.get_names( fp_names );
   if( SAMPLES_FORMAT == cs.output_format() ) {
     // this will stop the program if there are some and cs.fix_spaces_in_names()
     // is false
-    check_for_spaces_in_fp_names( cs.fix_spaces_in_names() , fps );
+    check_for_spaces_in_fp_names( cs.fix_spaces_in_names() , fp_names );
   }
 
-  nns.reserve( fps.size() );
-  unsigned int stop_fp = start_fp + num_fps_to_do;
-  if( stop_fp > fps.size() ) {
-    num_fps_to_do = fps.size() - start_fp;
-    stop_fp = fps.size();
-#ifdef NOTYET
-    cout << "revised num_fps_to_do to " << num_fps_to_do << endl;
-#endif
-  }
-  make_nnlists( cs.warm_feeling() , cs.threshold() , start_fp , stop_fp , fps ,
-                nns );
+  vector<unsigned int> block_starts;
+  triangle_blocks( fps.size() , num_slaves , block_starts );
+  start_fp = block_starts[slave_num];
+  num_fps_to_do = block_starts[slave_num + 1] - start_fp;
 
-  // pull the names out of the fingerprints and delete
-  fps_to_name( fps , fp_names );
+  vector<vector<pair<int,float> > > nbs;
+  vector<int> far_nums;
+  vector<float> far_dists;
+  make_nbs_lists( cs.warm_feeling() , cs.threshold() , cs.num_threads() ,
+                  start_fp , start_fp + num_fps_to_do , fps , nbs , far_nums ,
+                  far_dists );
+  if( num_slaves > 1 ) {
+    exchange_far_hits( slave_num , block_starts , far_nums , far_dists , nbs );
+  }
+  nbs_to_nnlists( nbs , nns );
+  if( cs.warm_feeling() ) {
+    cout << "Generated all " << num_fps_to_do << " near-neighbour lists."
+         << endl;
+  }
 
 #ifdef NOTYET
   cout << "leaving make_nnlists" << endl;
@@ -503,8 +714,8 @@ void serial_run( ClusterSettings &cs , vector<string> &seed_names ,
   vector<vector<int> > nns;
   vector<string> fp_names;
 
-  unsigned num_fps_to_do = numeric_limits<unsigned int>::max();
-  make_nnlists( cs , 0 , num_fps_to_do , fp_names , nns );
+  unsigned int start_fp , num_fps_to_do;
+  make_nnlists( cs , 0 , 1 , start_fp , num_fps_to_do , fp_names , nns );
   output_clusters( cs.warm_feeling() , fp_names , nns , cs.output_format() ,
                    output_stream , seed_names , singleton_names );
 
@@ -690,26 +901,14 @@ void tell_slaves_to_cross_off_cluster( int world_size ,
 }
 
 // *******************************************************************************
-void send_search_details( ClusterSettings &cs , unsigned int num_fps ,
-                          int world_size , unsigned int &slave_does ) {
-
-  // each slave needs to do something like num_fps / num_procs fps
-  // each against all targets
-  slave_does = num_fps / ( world_size - 1 );
-  while( slave_does * ( world_size - 1 ) < num_fps ) {
-    ++slave_does;
-  }
-  if( cs.warm_feeling() ) {
-    cout << "Each slave does " << slave_does << " fps " << endl;
-  }
+void send_search_details( ClusterSettings &cs , int world_size ) {
 
   for( int i = 1 ; i < world_size ; ++i ) {
 
     DACLIB::mpi_send_string( string( "Search_Details" ) , i );
     cs.send_contents_via_mpi( i );
-    // send the number of fps each slave must do, and the slave number,
-    // so it knows where to start
-    MPI_Send( &slave_does , 1 , MPI_UNSIGNED , i , 0 , MPI_COMM_WORLD );
+    // send the slave number. The slave works out which block of the
+    // distance matrix is its from that once it's read the fps.
     MPI_Send( &i , 1 , MPI_INT , i , 0 , MPI_COMM_WORLD );
 
   }
@@ -717,19 +916,17 @@ void send_search_details( ClusterSettings &cs , unsigned int num_fps ,
 }
 
 // *******************************************************************************
-void receive_search_details( ClusterSettings &cs , unsigned int &num_fps_to_do ,
-                             unsigned int &start_fp ) {
+void receive_search_details( ClusterSettings &cs , int &slave_num ,
+                             int &num_slaves ) {
 
   cs.receive_contents_via_mpi();
-  MPI_Recv( &num_fps_to_do , 1 , MPI_UNSIGNED , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  int slave_rank;
-  MPI_Recv( &slave_rank , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
-  --slave_rank; // first slave has rank 1.
-  start_fp = slave_rank * num_fps_to_do;
+  MPI_Recv( &slave_num , 1 , MPI_INT , 0 , 0 , MPI_COMM_WORLD , MPI_STATUS_IGNORE );
+  --slave_num; // first slave has rank 1.
+  MPI_Comm_size( MPI_COMM_WORLD , &num_slaves );
+  --num_slaves; // process 0 is the master
 
   if( cs.warm_feeling() ) {
-    cout << "This slave to do " << num_fps_to_do << " nnlists, starting at fp "
-         << start_fp << endl;
+    cout << "This is slave " << slave_num << " of " << num_slaves << endl;
   }
 
 }
@@ -788,11 +985,10 @@ void parallel_run( ClusterSettings &cs , int world_size ,
   if( num_fps ) {
     send_cwd_to_slaves( world_size );
     // send_search_details also fires off the jobs on the slaves
-    unsigned int chunk_size;
-    send_search_details( cs , num_fps , world_size , chunk_size );
+    send_search_details( cs , world_size );
     if( cs.warm_feeling() ) {
-      cout << "NN list requirements all sent. Each slave will produce "
-           << chunk_size << " NN lists." << endl;
+      cout << "NN list requirements all sent. The distance matrix will be split"
+           << " between " << world_size - 1 << " slaves." << endl;
     }
     // whilst the slaves are making the nnlists, there's time to re-read
     // the file and get the fingerprint names out
@@ -878,6 +1074,7 @@ void slave_event_loop() {
   string msg;
 
   ClusterSettings cs;
+  int slave_num , num_slaves;
   unsigned int num_fps_to_do , start_fp;
   vector<vector<int> > nns;
   vector<int> orig_nn_sizes;
@@ -898,8 +1095,9 @@ void slave_event_loop() {
     if( string( "Finished" ) == msg ) {
       break;
     } else if( string( "Search_Details" ) == msg ) {
-      receive_search_details( cs , num_fps_to_do , start_fp );
-      make_nnlists( cs , start_fp , num_fps_to_do , fp_names , nns );
+      receive_search_details( cs , slave_num , num_slaves );
+      make_nnlists( cs , slave_num , num_slaves , start_fp , num_fps_to_do ,
+                    fp_names , nns );
       // orig_nn_sizes needs to be indexed for the original fp set.
       make_orig_nn_sizes( fp_names.size() , start_fp , num_fps_to_do ,
                           nns , orig_nn_sizes );
@@ -16,6 +16,7 @@
 #include "stddefs.H"
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
+#include "FingerprintStore.H"
 #include "HashedFingerprint.H"
 #include "NotHashedFingerprint.H"
 
@@ -26,7 +27,7 @@ using namespace DAC_FINGERPRINTS;
 // ****************************************************************************
 int main( int argc , char **argv ) {
 
-  string usage( "./histogram {FLUSH_FPS|BITSTIRNGS} <PROBE_FILE> <TARGET_FILE> {start_num} {finish_num}" );
+  string usage( "./histogram {FLUSH_FPS|BITSTIRNGS|FPS} <PROBE_FILE> <TARGET_FILE> {start_num} {finish_num}" );
 
   if( argc < 4 ) {
     cout << usage << endl;
@@ -38,7 +39,7 @@ int main( int argc , char **argv ) {
   string bitstring_separator;
   decode_format_string( string( argv[1] ) , fp_format , binary_file , bitstring_separator );
 
-  vector<FingerprintBase *> probe_fps , target_fps;
+  FingerprintStore probe_fps , target_fps;
   read_fp_file( string( argv[2] ) , fp_format , bitstring_separator , probe_fps );
   read_fp_file( string( argv[3] ) , fp_format , bitstring_separator , target_fps );
 
@@ -57,10 +58,14 @@ int main( int argc , char **argv ) {
   }
 
   vector<double> hist_fracs( 21 , 0.0 );
+  vector<double> dists( target_fps.size() );
   for( unsigned int i = start ; i < finish ; ++i ) {
     vector<unsigned int> dist_counts( 21 , 0 );
-    BOOST_FOREACH( FingerprintBase *tfp , target_fps ) {
-      double dist = probe_fps[i]->calc_distance( *tfp );
+    if( !target_fps.empty() ) {
+      target_fps.calc_distances( probe_fps , i , 0 , target_fps.size() ,
+                                 &dists[0] );
+    }
+    BOOST_FOREACH( double dist , dists ) {
       int i_dist = int( 20.0 * dist );
       ++dist_counts[i_dist];
     }
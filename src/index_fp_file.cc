@@ -0,0 +1,138 @@
+//
+// file index_fp_file.cc
+// 16th October 2026
+//
+// Builds the sidecar index (FingerprintIndex.H) of one or more binary
+// fingerprint files, gzipped or not, so that satan, cluster and the rest can
+// count them, get their names and start reading part way through without
+// going through the whole file.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FileExceptions.H"
+#include "FingerprintBase.H"
+#include "FingerprintIndex.H"
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+using namespace std;
+using namespace DAC_FINGERPRINTS;
+namespace po = boost::program_options;
+
+extern string BUILD_TIME;
+
+// ****************************************************************************
+void build_program_options( po::options_description &desc ,
+                            vector<string> &input_fp_files ,
+                            string &format_string ,
+                            unsigned int &record_interval ,
+                            unsigned int &checkpoint_span ,
+                            bool &warm_feeling ) {
+
+  desc.add_options()
+      ( "help" , "Produce help text." )
+      ( "input-fp-file,I" , po::value<vector<string> >( &input_fp_files ) ,
+        "Input filename, may be given more than once." )
+      ( "input-format,F" , po::value<string>( &format_string ) ,
+        "Input format : FLUSH_FPS|BIN_FRAG_NUMS (default FLUSH_FPS)" )
+      ( "record-interval" , po::value<unsigned int>( &record_interval ) ,
+        "Store the position of every this many fingerprints (default 256)." )
+      ( "checkpoint-span" , po::value<unsigned int>( &checkpoint_span ) ,
+        "For gzipped files, the megabytes of uncompressed data between inflate checkpoints, each of which takes 32K of index (default 1)." )
+      ( "verbose,V" , po::value<bool>( &warm_feeling )->zero_tokens() ,
+        "Verbose mode" )
+      ( "warm-feeling,W" , po::value<bool>( &warm_feeling )->zero_tokens() ,
+        "Verbose mode" );
+
+}
+
+// ****************************************************************************
+void verify_program_options( po::options_description &desc ,
+                             po::variables_map &vm , int argc ,
+                             bool &verbose ) {
+
+  if( 1 == argc || vm.count( "help" ) ) {
+    cout << desc << endl;
+    exit( 1 );
+  }
+
+  if( !vm.count( "input-fp-file" ) ) {
+    cerr << "Need an input fingerprint file." << endl << desc << endl;
+    exit( 1 );
+  }
+
+  if( vm.count( "verbose" ) || vm.count( "warm-feeling" ) )
+    verbose = true;
+
+}
+
+// ****************************************************************************
+int main( int argc , char **argv ) {
+
+  vector<string> input_fp_files;
+  string format_string , bitstring_separator;
+  unsigned int record_interval( 256 ) , checkpoint_span( 1 );
+  bool warm_feeling( false ) , binary_file( false );
+  po::options_description desc( "Allowed Options" );
+  build_program_options( desc , input_fp_files , format_string ,
+                         record_interval , checkpoint_span , warm_feeling );
+
+  po::variables_map vm;
+  po::store( po::parse_command_line( argc , argv , desc ) , vm );
+  po::notify( vm );
+
+  verify_program_options( desc , vm , argc , warm_feeling );
+
+  if( warm_feeling ) {
+    cout << "index_fp_file built " << BUILD_TIME << endl;
+  }
+
+  FP_FILE_FORMAT fp_file_format( FLUSH_FPS );
+  if( format_string.empty() ) {
+    format_string = "FLUSH_FPS";
+  }
+  try {
+    decode_format_string( format_string , fp_file_format , binary_file ,
+                          bitstring_separator );
+  } catch( FingerprintInputFormatError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+  if( !binary_file ) {
+    cerr << "Only binary fingerprint files, FLUSH_FPS or BIN_FRAG_NUMS, can"
+         << " be indexed." << endl;
+    exit( 1 );
+  }
+  if( !record_interval ) {
+    cerr << "The record interval must be at least 1." << endl;
+    exit( 1 );
+  }
+
+  for( unsigned int i = 0 , is = input_fp_files.size() ; i < is ; ++i ) {
+    size_t num_fps = 0;
+    try {
+      num_fps = build_fp_index( input_fp_files[i] , fp_file_format ,
+                                record_interval ,
+                                size_t( checkpoint_span ) * 1024 * 1024 );
+    } catch( DACLIB::FileReadOpenError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
+    } catch( DACLIB::FileWriteOpenError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
+    } catch( FingerprintFileError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
+    }
+    if( warm_feeling ) {
+      cout << "Wrote " << FingerprintIndex::index_file( input_fp_files[i] )
+           << " for " << num_fps << " fingerprints." << endl;
+    }
+  }
+
+}
@@ -5,6 +5,15 @@
 // 16th May 2007
 //
 // Combines 2 or more fp files into a new one.
+// It's also the way to convert between version 1 and version 2 flush files.
+// Flush input files can be either, and --output-format FLUSH_FPS_V2 writes
+// version 2.
+// With --gzip-block-size, gzipped binary output is written in independent
+// blocks with an index (BlockedGzipFile.H).
+// The files are read and written a piece at a time.  When the input and
+// output are the same binary format and nothing about the records needs to
+// change, they're copied across as they are, without being made into
+// fingerprints.
 
 #include <cstdio>
 #include <fstream>
@@ -13,15 +22,20 @@
 #include <vector>
 
 #include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
 
+#include "BinaryRecordScanner.H"
+#include "BlockedGzipFile.H"
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
+#include "FlushV2File.H"
 #include "HashedFingerprint.H"
+#include "MappedFingerprintFile.H"
 #include "NotHashedFingerprint.H"
 
 using namespace std;
@@ -31,11 +45,17 @@ namespace po = boost::program_options;
 
 extern string BUILD_TIME;
 
+// the number of fingerprints read at a time when they have to be decoded,
+// and the size of the pieces files are copied in when they don't.
+static const size_t MERGE_CHUNK_SIZE = 4096;
+static const size_t COPY_BUFFER_SIZE = 1 << 20;
+
 // ***********************************************************************
 void build_program_options( po::options_description &desc ,
                             vector<string> &input_files , string &output_file ,
                             string &input_format_string , string &output_format_string , 
-			    string &bitstring_separator , bool &warm_feeling ) {
+			    string &bitstring_separator ,
+                            unsigned int &gzip_block_size , bool &warm_feeling ) {
 
   desc.add_options()
       ( "help" , "Produce help text." )
@@ -43,9 +63,11 @@ void build_program_options( po::options_description &desc ,
       ( "input-file,I" , po::value<vector<string> >( &input_files ) ,
         "Input filename" )
       ( "input-format" , po::value<string>( &input_format_string ) ,
-        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS, which reads either version of flush file)" )
       ( "output-format" , po::value<string>( &output_format_string ) ,
-        "Output format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+        "Output format : FLUSH_FPS|FLUSH_FPS_V2|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
+      ( "gzip-block-size" , po::value<unsigned int>( &gzip_block_size ) ,
+        "For gzipped FLUSH_FPS or BIN_FRAG_NUMS output, start a new gzip member every this many fingerprints and write an index alongside, so the file can be read from any block and in parallel (default 0, one gzip stream)." )
       ( "verbose,V" , po::value<bool>( &warm_feeling )->zero_tokens() ,
         "Verbose mode" )
       ( "warm-feeling" , po::value<bool>( &warm_feeling )->zero_tokens() ,
@@ -102,12 +124,60 @@ void open_output_file( const string &output_file , FP_FILE_FORMAT fp_file_format
 }
 
 // *************************************************************************
-void write_fps_to_file( gzFile &gzfp , FILE *ucfp , FP_FILE_FORMAT fp_file_format ,
+// a version 2 flush file, which is never compressed.
+void open_output_file( const string &output_file ,
+                       scoped_ptr<FlushV2Writer> &v2fp ) {
+
+  boost::regex gzip( ".*\\.gz" );
+  if( boost::regex_match( output_file , gzip ) ) {
+    cerr << "Version 2 flush files can't be compressed, so can't be written"
+         << " to " << output_file << "." << endl;
+    exit( 1 );
+  }
+  try {
+    v2fp.reset( new FlushV2Writer( output_file ,
+                                   HashedFingerprint::num_ints() * sizeof( unsigned int ) ) );
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+}
+
+// *************************************************************************
+// a gzipped binary file in blocks
+void open_output_file( const string &output_file , FP_FILE_FORMAT fp_file_format ,
+                       unsigned int gzip_block_size ,
+                       scoped_ptr<BlockedGzipWriter> &bgfp ) {
+
+  try {
+    bgfp.reset( new BlockedGzipWriter( output_file ,
+                                       HashedFingerprint::num_ints() * sizeof( unsigned int ) ,
+                                       fp_file_format , gzip_block_size ) );
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+}
+
+// *************************************************************************
+void write_fps_to_file( gzFile &gzfp , FILE *ucfp , FlushV2Writer *v2fp ,
+                        BlockedGzipWriter *bgfp ,
+                        FP_FILE_FORMAT fp_file_format ,
                         const string &bitstring_separator ,
                         const vector<FingerprintBase *> &fps ) {
 
   for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
 
+    if( v2fp ) {
+      v2fp->write( *static_cast<HashedFingerprint *>( fps[i] ) );
+      continue;
+    }
+    if( bgfp ) {
+      bgfp->write( *fps[i] );
+      continue;
+    }
     switch( fp_file_format ) {
     case FLUSH_FPS : case BIN_FRAG_NUMS :
       if( gzfp ) {
@@ -123,8 +193,116 @@ void write_fps_to_file( gzFile &gzfp , FILE *ucfp , FP_FILE_FORMAT fp_file_forma
         fps[i]->ascii_write( ucfp , bitstring_separator );
       }
       break;
+    case FPS :
+      if( gzfp ) {
+        static_cast<HashedFingerprint *>( fps[i] )->fps_write( gzfp );
+      } else {
+        static_cast<HashedFingerprint *>( fps[i] )->fps_write( ucfp );
+      }
+      break;
+    }
+  }
+
+}
+
+// *************************************************************************
+// open whichever output file is wanted, if it isn't open already, once the
+// size of the fingerprints is known.  Each flush file read after that has to
+// have fingerprints of the same size.
+void ensure_output_open( const string &output_file ,
+                         FP_FILE_FORMAT in_fp_file_format ,
+                         FP_FILE_FORMAT out_fp_file_format , bool v2_output ,
+                         unsigned int gzip_block_size ,
+                         gzFile &gzfp , FILE *&ucfp ,
+                         scoped_ptr<FlushV2Writer> &v2fp ,
+                         scoped_ptr<BlockedGzipWriter> &bgfp ,
+                         unsigned int &out_num_ints ) {
+
+  if( gzfp || ucfp || v2fp || bgfp ) {
+    if( FLUSH_FPS == in_fp_file_format
+        && HashedFingerprint::num_ints() != out_num_ints ) {
+      cerr << "Can't merge fingerprints of " << HashedFingerprint::num_ints()
+           << " ints with ones of " << out_num_ints << "." << endl;
+      exit( 1 );
+    }
+    return;
+  }
+
+  out_num_ints = HashedFingerprint::num_ints();
+  if( v2_output ) {
+    if( FLUSH_FPS != in_fp_file_format && BITSTRINGS != in_fp_file_format
+        && FPS != in_fp_file_format ) {
+      cerr << "Only hashed fingerprints can go in a version 2 flush file."
+           << endl;
+      exit( 1 );
+    }
+    open_output_file( output_file , v2fp );
+  } else if( gzip_block_size ) {
+    open_output_file( output_file , out_fp_file_format , gzip_block_size ,
+                      bgfp );
+  } else {
+    open_output_file( output_file , out_fp_file_format , gzfp , ucfp );
+  }
+
+}
+
+// *************************************************************************
+void delete_fps( vector<FingerprintBase *> &fps ) {
+
+  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
+    delete fps[i];
+  }
+  fps.clear();
+
+}
+
+// *************************************************************************
+// the next num_fps fingerprints from a version 2 file, or as many as there
+// are left, as HashedFingerprints that the caller must delete.
+void read_next_v2_fps( MappedFingerprintFile &mapped , size_t num_fps ,
+                       vector<FingerprintBase *> &fps ) {
+
+  FingerprintView fp;
+  while( fps.size() < num_fps && mapped.next( fp ) ) {
+    // the constructor copies the bits
+    unsigned int *bits = const_cast<unsigned int *>( reinterpret_cast<const unsigned int *>( fp.bits_ ) );
+    fps.push_back( new HashedFingerprint( fp.name() , bits ) );
+  }
+
+}
+
+// *************************************************************************
+// copy the records of infp, which is past its header, to the output as they
+// are, a buffer at a time.  Gives back the number copied.
+size_t copy_records( const string &input_file , gzFile infp ,
+                     FP_FILE_FORMAT fp_file_format ,
+                     gzFile gzfp , FILE *ucfp ) {
+
+  BinaryRecordScanner counter( fp_file_format ,
+                               HashedFingerprint::num_ints() * sizeof( unsigned int ) );
+  vector<unsigned char> buf( COPY_BUFFER_SIZE );
+  int num_read;
+  while( ( num_read = gzread( infp , &buf[0] , buf.size() ) ) > 0 ) {
+    counter.add( &buf[0] , num_read );
+    bool written = gzfp ? num_read == gzwrite( gzfp , &buf[0] , num_read )
+                        : size_t( num_read ) == fwrite( &buf[0] , 1 ,
+                                                        num_read , ucfp );
+    if( !written ) {
+      cerr << "Error writing merged fingerprints." << endl;
+      exit( 1 );
     }
   }
+  if( num_read < 0 ) {
+    cerr << "Error reading " << input_file << "." << endl;
+    exit( 1 );
+  }
+  if( !counter.at_record_end() ) {
+    cerr << input_file << " doesn't end at the end of a fingerprint, so it's"
+         << " damaged or truncated." << endl;
+    exit( 1 );
+  }
+
+  return counter.num_records();
 
 }
 
@@ -137,12 +315,13 @@ int main( int argc , char **argv ) {
   string input_format_string( "FLUSH_FPS" );
   string output_file , output_format_string( "FLUSH_FPS" );
   string bitstring_separator;
+  unsigned int gzip_block_size( 0 );
   bool   warm_feeling( false ) , binary_file( false );
 
   po::options_description desc( "Allowed Options" );
   build_program_options( desc , input_files , output_file ,
 			 input_format_string , output_format_string ,
-                         bitstring_separator , warm_feeling );
+                         bitstring_separator , gzip_block_size , warm_feeling );
 
   po::variables_map vm;
   po::store( po::parse_command_line( argc , argv , desc ) , vm );
@@ -150,57 +329,139 @@ int main( int argc , char **argv ) {
 
   verify_program_options( desc , vm , argc , warm_feeling );
 
+  // version 2 is still flush fingerprints as far as reading them goes
+  bool v2_output = "FLUSH_FPS_V2" == output_format_string;
+  if( v2_output ) {
+    output_format_string = "FLUSH_FPS";
+  }
+  if( "FLUSH_FPS_V2" == input_format_string ) {
+    input_format_string = "FLUSH_FPS";
+  }
+
   FP_FILE_FORMAT in_fp_file_format( FLUSH_FPS );
   decode_format_string( input_format_string , in_fp_file_format ,
 			binary_file , bitstring_separator );
   FP_FILE_FORMAT out_fp_file_format( FLUSH_FPS );
+  binary_file = false;
   decode_format_string( output_format_string , out_fp_file_format ,
 			binary_file , bitstring_separator );
+  if( gzip_block_size
+      && ( !binary_file || v2_output
+           || !boost::regex_match( output_file , boost::regex( ".*\\.gz" ) ) ) ) {
+    cerr << "--gzip-block-size is only for gzipped FLUSH_FPS or BIN_FRAG_NUMS"
+         << " output." << endl;
+    exit( 1 );
+  }
+
+  if( FPS == out_fp_file_format && FLUSH_FPS != in_fp_file_format
+      && BITSTRINGS != in_fp_file_format && FPS != in_fp_file_format ) {
+    cerr << "Only hashed fingerprints can go in an FPS file." << endl;
+    exit( 1 );
+  }
 
   gzFile gzfp = 0; // for binary formats
   FILE *ucfp = 0;
+  scoped_ptr<FlushV2Writer> v2fp;
+  scoped_ptr<BlockedGzipWriter> bgfp;
+  unsigned int out_num_ints = 0;
+
+  // binary records can be copied across as they are if nothing about them
+  // needs to change.
+  bool passthrough = binary_file && in_fp_file_format == out_fp_file_format
+      && !v2_output && !gzip_block_size;
 
-  int num_fps_read = 0;
+  size_t num_fps_read = 0;
   for( int i = 0 , is = input_files.size() ; i < is ; ++i ) {
-    vector<FingerprintBase *> next_fps;
     if( warm_feeling ) {
       cout << "Reading fingerprint file " << input_files[i] << endl;
     }
-    try {
-      read_fp_file( input_files[i] , in_fp_file_format , bitstring_separator ,
-                    next_fps );
-    } catch( DACLIB::FileReadOpenError &e ) {
-      cerr << e.what() << endl;
-      cout << e.what() << endl;
-      exit( 1 );
-    } catch( FingerprintFileError &e ) {
-      cerr << e.what() << endl;
-      cout << e.what() << endl;
-      exit( 1 );
-    } catch( DAC_FINGERPRINTS::HashedFingerprintLengthError &e ) {
-      cerr << e.what() << endl;
-      cout << e.what() << endl;
-      exit( 1 );
+    size_t num_in_file = 0;
+    if( FLUSH_FPS == in_fp_file_format
+        && MappedFingerprintFile::flush_v2( input_files[i] ) ) {
+      // a chunk at a time through a mapping, like the other formats
+      scoped_ptr<MappedFingerprintFile> mapped;
+      try {
+        mapped.reset( new MappedFingerprintFile( input_files[i] ,
+                                                 in_fp_file_format ) );
+      } catch( DACLIB::FileReadOpenError &e ) {
+        cerr << e.what() << endl;
+        cout << e.what() << endl;
+        exit( 1 );
+      } catch( FingerprintFileError &e ) {
+        cerr << e.what() << endl;
+        cout << e.what() << endl;
+        exit( 1 );
+      }
+      while( 1 ) {
+        vector<FingerprintBase *> next_fps;
+        read_next_v2_fps( *mapped , MERGE_CHUNK_SIZE , next_fps );
+        ensure_output_open( output_file , in_fp_file_format ,
+                            out_fp_file_format , v2_output , gzip_block_size ,
+                            gzfp , ucfp , v2fp , bgfp , out_num_ints );
+        write_fps_to_file( gzfp , ucfp , v2fp.get() , bgfp.get() ,
+                           out_fp_file_format , bitstring_separator ,
+                           next_fps );
+        size_t num_read = next_fps.size();
+        num_in_file += num_read;
+        delete_fps( next_fps );
+        if( num_read < MERGE_CHUNK_SIZE ) {
+          break;
+        }
+      }
+    } else {
+      gzFile infp = 0;
+      bool byteswapping = false;
+      try {
+        open_fp_file_for_reading( input_files[i] , in_fp_file_format ,
+                                  byteswapping , infp );
+      } catch( DACLIB::FileReadOpenError &e ) {
+        cerr << e.what() << endl;
+        cout << e.what() << endl;
+        exit( 1 );
+      } catch( FingerprintFileError &e ) {
+        cerr << e.what() << endl;
+        cout << e.what() << endl;
+        exit( 1 );
+      }
+      if( passthrough && !byteswapping ) {
+        ensure_output_open( output_file , in_fp_file_format ,
+                            out_fp_file_format , v2_output , gzip_block_size ,
+                            gzfp , ucfp , v2fp , bgfp , out_num_ints );
+        num_in_file = copy_records( input_files[i] , infp , in_fp_file_format ,
+                                    gzfp , ucfp );
+      } else {
+        // a chunk at a time, so there's never more than that in memory.
+        // The output's opened after the first one, when the size of the
+        // fingerprints is known.
+        while( 1 ) {
+          vector<FingerprintBase *> next_fps;
+          read_next_fps_from_file( infp , byteswapping , in_fp_file_format ,
+                                   bitstring_separator , MERGE_CHUNK_SIZE ,
+                                   next_fps );
+          ensure_output_open( output_file , in_fp_file_format ,
+                              out_fp_file_format , v2_output , gzip_block_size ,
+                              gzfp , ucfp , v2fp , bgfp , out_num_ints );
+          write_fps_to_file( gzfp , ucfp , v2fp.get() , bgfp.get() ,
+                             out_fp_file_format , bitstring_separator ,
+                             next_fps );
+          size_t num_read = next_fps.size();
+          num_in_file += num_read;
+          delete_fps( next_fps );
+          if( num_read < MERGE_CHUNK_SIZE ) {
+            break;
+          }
+        }
+      }
+      gzclose( infp );
     }
 
-    num_fps_read += next_fps.size();
+    num_fps_read += num_in_file;
     if( warm_feeling ) {
-      cout << "Read " << next_fps.size() << " fingerprint";
-      if( next_fps.size() > 1 )
+      cout << "Read " << num_in_file << " fingerprint";
+      if( num_in_file > 1 )
         cout << "s";
       cout << " from file number " << i + 1 << " : " << input_files[i] << endl;
     }
-    // delay opening file until we've read a fingerprint and know how
-    // many chars there are in it.
-    if( !gzfp && !ucfp ) {
-      open_output_file( output_file , out_fp_file_format , gzfp , ucfp );
-    }
-
-    write_fps_to_file( gzfp , ucfp , out_fp_file_format , bitstring_separator ,
-                       next_fps );
-    for( int j = 0 , js = next_fps.size() ; j < js ; ++j ) {
-      delete next_fps[j];
-    }
   }
 
   if( warm_feeling ) {
@@ -211,6 +472,12 @@ int main( int argc , char **argv ) {
     cout << "." << endl;
   }
 
+  if( v2fp ) {
+    v2fp->finish();
+  }
+  if( bgfp ) {
+    bgfp->finish();
+  }
   if( gzfp ) {
     gzclose( gzfp );
   }
@@ -6,18 +6,33 @@
 // 19th October 2015
 //
 // A simple program to read a fingerprints file and write it out in reverse order.
-
+// It works a block of fingerprints at a time, so it doesn't need the whole
+// file in memory.  Uncompressed binary files are walked once to find where
+// the blocks start, and the blocks read back last first.  Anything else is
+// reversed a run at a time into a temporary file next to the output, and the
+// runs copied out of that last first.  Version 2 flush files are reversed
+// into version 2 files, a block at a time straight from a mapping.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 
+#include <unistd.h>
+
+#include "BinaryRecordScanner.H"
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
+#include "FlushV2File.H"
 #include "HashedFingerprint.H"
+#include "MappedFingerprintFile.H"
 #include "NotHashedFingerprint.H"
 
 #include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/options_description.hpp>
@@ -31,6 +46,11 @@ namespace po = boost::program_options;
 
 extern string BUILD_TIME;
 
+// the number of fingerprints reversed at a time, and the size of the
+// pieces files are read and copied in.
+static const size_t REVERSE_BLOCK_SIZE = 16384;
+static const size_t COPY_BUFFER_SIZE = 1 << 20;
+
 // ****************************************************************************
 void build_program_options( po::options_description &desc ,
                             string &input_fp_file , string &output_file ,
@@ -43,7 +63,7 @@ void build_program_options( po::options_description &desc ,
       ( "input-fp-file,I" , po::value<string>( &input_fp_file ) ,
         "Input filename" )
       ( "input-format,F" , po::value<string>( &format_string ) ,
-        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
+        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
       ( "verbose,V" , po::value<bool>( &warm_feeling )->zero_tokens() ,
         "Verbose mode" )
       ( "warm-feeling,W" , po::value<bool>( &warm_feeling )->zero_tokens() ,
@@ -119,8 +139,250 @@ void write_fp_to_file( const FingerprintBase &fp , gzFile &gzfp ,
       fp.ascii_write( ucfp , bitstring_separator );
     }
     break;
+  case FPS :
+    if( gzfp ) {
+      static_cast<const HashedFingerprint &>( fp ).fps_write( gzfp );
+    } else {
+      static_cast<const HashedFingerprint &>( fp ).fps_write( ucfp );
+    }
+    break;
+  }
+
+}
+
+// ****************************************************************************
+void write_bytes( const unsigned char *buf , size_t len , gzFile gzfp ,
+                  FILE *ucfp ) {
+
+  bool written = gzfp ? int( len ) == gzwrite( gzfp , buf , len )
+                      : len == fwrite( buf , 1 , len , ucfp );
+  if( !written ) {
+    cerr << "Error writing reversed fingerprints." << endl;
+    exit( 1 );
+  }
+
+}
+
+// ****************************************************************************
+// reverse an uncompressed binary file of this machine's byte order.  A pass
+// through it keeps where every REVERSE_BLOCK_SIZE'th fingerprint starts,
+// then the blocks are read last first and the records in each written out
+// back to front, as they are.
+size_t reverse_records( const string &input_fp_file , gzFile infp ,
+                        FP_FILE_FORMAT fp_file_format ,
+                        gzFile gzfp , FILE *ucfp ) {
+
+  size_t num_bytes_in_fp = HashedFingerprint::num_ints() * sizeof( unsigned int );
+  BinaryRecordScanner scanner( fp_file_format , num_bytes_in_fp ,
+                               gztell( infp ) , REVERSE_BLOCK_SIZE );
+  vector<unsigned char> buf( COPY_BUFFER_SIZE );
+  int num_read;
+  while( ( num_read = gzread( infp , &buf[0] , buf.size() ) ) > 0 ) {
+    scanner.add( &buf[0] , num_read );
+  }
+  if( num_read < 0 || !scanner.at_record_end() ) {
+    cerr << input_fp_file << " doesn't end at the end of a fingerprint, so"
+         << " it's damaged or truncated." << endl;
+    exit( 1 );
+  }
+
+  vector<uint64_t> block_starts( scanner.record_starts() );
+  block_starts.push_back( scanner.offset() );
+  vector<unsigned char> block , rev_block;
+  for( size_t i = block_starts.size() - 1 ; i > 0 ; --i ) {
+    size_t block_len = block_starts[i] - block_starts[i - 1];
+    block.resize( block_len );
+    rev_block.resize( block_len );
+    if( -1 == gzseek( infp , block_starts[i - 1] , SEEK_SET )
+        || int( block_len ) != gzread( infp , &block[0] , block_len ) ) {
+      cerr << "Error reading " << input_fp_file << "." << endl;
+      exit( 1 );
+    }
+    BinaryRecordScanner block_scanner( fp_file_format , num_bytes_in_fp , 0 ,
+                                       1 );
+    block_scanner.add( &block[0] , block_len );
+    const vector<uint64_t> &rec_starts = block_scanner.record_starts();
+    unsigned char *out = &rev_block[0];
+    for( size_t j = rec_starts.size() ; j-- > 0 ; ) {
+      size_t rec_end = j + 1 < rec_starts.size() ? rec_starts[j + 1] : block_len;
+      out = copy( block.begin() + rec_starts[j] , block.begin() + rec_end ,
+                  out );
+    }
+    write_bytes( &rev_block[0] , block_len , gzfp , ucfp );
+  }
+
+  return scanner.num_records();
+
+}
+
+// ****************************************************************************
+// a temporary file in the same directory as output_file.  It's deleted as
+// soon as it's opened, so it goes when it's closed or the program stops.
+FILE *open_temp_file( const string &output_file ) {
+
+  string temp_name = output_file + ".XXXXXX";
+  vector<char> name( temp_name.begin() , temp_name.end() );
+  name.push_back( 0 );
+  int fd = mkstemp( &name[0] );
+  FILE *fp = -1 == fd ? 0 : fdopen( fd , "w+b" );
+  if( !fp ) {
+    cerr << "Couldn't open temporary file " << &name[0] << "." << endl;
+    exit( 1 );
+  }
+  unlink( &name[0] );
+
+  return fp;
+
+}
+
+// ****************************************************************************
+// reverse anything else: a gzipped or text file, or one from a machine of
+// the other byte order.  The fingerprints are read REVERSE_BLOCK_SIZE at a
+// time, and each run of them written back to front to a temporary file.
+// Then the runs are copied from there to the output, last run first.  The
+// output's opened at the end, when the size of the fingerprints is known.
+size_t reverse_runs( gzFile infp , bool byteswapping ,
+                     FP_FILE_FORMAT fp_file_format ,
+                     const string &bitstring_separator ,
+                     const string &output_file , gzFile &gzfp , FILE *&ucfp ) {
+
+  FILE *tempfp = open_temp_file( output_file );
+  gzFile no_gzfp = 0;
+  vector<off_t> run_starts;
+  size_t num_fps = 0;
+  while( 1 ) {
+    vector<FingerprintBase *> fps;
+    read_next_fps_from_file( infp , byteswapping , fp_file_format ,
+                             bitstring_separator , REVERSE_BLOCK_SIZE , fps );
+    run_starts.push_back( ftello( tempfp ) );
+    for( size_t i = fps.size() ; i-- > 0 ; ) {
+      write_fp_to_file( *fps[i] , no_gzfp , tempfp , fp_file_format ,
+                        bitstring_separator );
+      delete fps[i];
+    }
+    num_fps += fps.size();
+    if( fps.size() < REVERSE_BLOCK_SIZE ) {
+      break;
+    }
+  }
+  run_starts.push_back( ftello( tempfp ) );
+
+  open_output_file( output_file , fp_file_format , gzfp , ucfp );
+  vector<unsigned char> buf( COPY_BUFFER_SIZE );
+  for( size_t i = run_starts.size() - 1 ; i > 0 ; --i ) {
+    if( fseeko( tempfp , run_starts[i - 1] , SEEK_SET ) ) {
+      cerr << "Error reading temporary file." << endl;
+      exit( 1 );
+    }
+    for( off_t to_copy = run_starts[i] - run_starts[i - 1] ; to_copy > 0 ; ) {
+      size_t n = min( off_t( buf.size() ) , to_copy );
+      if( n != fread( &buf[0] , 1 , n , tempfp ) ) {
+        cerr << "Error reading temporary file." << endl;
+        exit( 1 );
+      }
+      write_bytes( &buf[0] , n , gzfp , ucfp );
+      to_copy -= n;
+    }
+  }
+  fclose( tempfp );
+
+  return num_fps;
+
+}
+
+// ****************************************************************************
+// reverse a version 2 flush file into another.  Any fingerprint can be got
+// at directly, so the blocks are taken last first, each read front to back
+// and written out back to front.  The views stay valid as long as the
+// mapping does.
+size_t reverse_v2( const string &input_fp_file , const string &output_file ) {
+
+  boost::regex gzip( ".*\\.gz" );
+  if( boost::regex_match( output_file , gzip ) ) {
+    cerr << "Version 2 flush files can't be compressed, so can't be written"
+         << " to " << output_file << "." << endl
+         << "Use merge_fp_files to convert " << input_fp_file
+         << " to version 1 first." << endl;
+    exit( 1 );
+  }
+
+  scoped_ptr<MappedFingerprintFile> mapped;
+  scoped_ptr<FlushV2Writer> v2fp;
+  try {
+    mapped.reset( new MappedFingerprintFile( input_fp_file , FLUSH_FPS ) );
+    v2fp.reset( new FlushV2Writer( output_file ,
+                                   HashedFingerprint::num_ints() * sizeof( unsigned int ) ) );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
   }
 
+  size_t num_fps = mapped->size();
+  vector<FingerprintView> block;
+  for( size_t block_end = num_fps ; block_end > 0 ; ) {
+    size_t block_start = block_end > REVERSE_BLOCK_SIZE ?
+        block_end - REVERSE_BLOCK_SIZE : 0;
+    mapped->seek( block_start );
+    block.resize( block_end - block_start );
+    for( size_t i = 0 , is = block.size() ; i < is ; ++i ) {
+      mapped->next( block[i] );
+    }
+    for( size_t i = block.size() ; i-- > 0 ; ) {
+      v2fp->write( block[i].name() ,
+                   reinterpret_cast<const unsigned int *>( block[i].bits_ ) );
+    }
+    block_end = block_start;
+  }
+  v2fp->finish();
+
+  return num_fps;
+
+}
+
+// ****************************************************************************
+// reverse anything that isn't a version 2 flush file, by whichever of
+// reverse_records and reverse_runs suits it.  The output files are left open.
+size_t reverse_stream( const string &input_fp_file ,
+                       FP_FILE_FORMAT fp_file_format , bool binary_file ,
+                       const string &bitstring_separator ,
+                       const string &output_file , gzFile &gzfp , FILE *&ucfp ) {
+
+  bool byteswapping = false;
+  gzFile infp = 0;
+  try {
+    if( binary_file ) {
+      open_fp_file_for_reading( input_fp_file , fp_file_format ,
+                                byteswapping , infp );
+    } else {
+      open_fp_file_for_reading( input_fp_file , infp );
+    }
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+  size_t num_fps = 0;
+  if( binary_file && !byteswapping && gzdirect( infp ) ) {
+    open_output_file( output_file , fp_file_format , gzfp , ucfp );
+    num_fps = reverse_records( input_fp_file , infp , fp_file_format , gzfp ,
+                               ucfp );
+  } else {
+    num_fps = reverse_runs( infp , byteswapping , fp_file_format ,
+                            bitstring_separator , output_file , gzfp , ucfp );
+  }
+  gzclose( infp );
+
+  return num_fps;
+
 }
 
 // ****************************************************************************
@@ -147,37 +409,18 @@ int main( int argc , char **argv ) {
   decode_format_string( format_string , fp_file_format , binary_file ,
                         bitstring_separator );
 
-  bool byteswapping = false;
   gzFile gzfp = 0;
-  try {
-    if( binary_file ) {
-      open_fp_file_for_reading( input_fp_file , fp_file_format ,
-                                byteswapping , gzfp );
-    } else {
-      open_fp_file_for_reading( input_fp_file , gzfp );
-    }
-  } catch( DACLIB::FileReadOpenError &e ) {
-    cerr << e.what() << endl;
-    exit( 1 );
-  } catch( FingerprintFileError &e ) {
-    cerr << e.what() << endl;
-    exit( 1 );
+  FILE *ucfp = 0;
+  size_t num_fps = 0;
+  if( FLUSH_FPS == fp_file_format
+      && MappedFingerprintFile::flush_v2( input_fp_file ) ) {
+    num_fps = reverse_v2( input_fp_file , output_file );
+  } else {
+    num_fps = reverse_stream( input_fp_file , fp_file_format , binary_file ,
+                              bitstring_separator , output_file , gzfp , ucfp );
   }
-
-  vector<FingerprintBase *> fps;
-  read_fp_file( gzfp , byteswapping , fp_file_format ,
-                bitstring_separator , fps );
   if( warm_feeling ) {
-    cout << "Read " << fps.size() << " fingerprints" << endl;
-  }
-
-  gzfp = 0; // for binary formats
-  FILE *ucfp = 0;
-  open_output_file( output_file , fp_file_format , gzfp , ucfp );
-
-  for( int i = fps.size() - 1 , is = 0 ; i >= is ; --i ) {
-    write_fp_to_file( *fps[i] , gzfp , ucfp , fp_file_format ,
-                      bitstring_separator );
+    cout << "Reversed " << num_fps << " fingerprints" << endl;
   }
 
   if( gzfp ) {
@@ -187,6 +430,4 @@ int main( int argc , char **argv ) {
     fclose( ucfp );
   }
 
-  gzclose( gzfp );
-
 }
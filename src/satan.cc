@@ -8,6 +8,8 @@
 // in the first that have at least a given number of fingerprints in the second
 // within a threshold tanimoto distance.
 
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <fstream>
 #include <iomanip>
@@ -20,9 +22,15 @@
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
+#include "FingerprintBlockReader.H"
+#include "FingerprintIndex.H"
+#include "FingerprintStore.H"
+#include "MappedFingerprintFile.H"
 #include "HashedFingerprint.H"
 #include "NotHashedFingerprint.H"
 #include "SatanSettings.H"
@@ -57,6 +65,10 @@ void mpi_rec_string( int source_rank , string &str );
 extern string BUILD_TIME; // in build_time.cc
 
 // static const int FP_CHUNK_SIZE = 500000;
+// the number of targets read at a time
+static const unsigned int TARGET_CHUNK_SIZE = 1024;
+
+typedef boost::shared_ptr<FingerprintStore> pFPS;
 
 // ****************************************************************************
 void output_neighbours_satan( unsigned int min_count ,
@@ -264,24 +276,22 @@ void output_counts( ostream &output_stream ,
 }
 
 // ****************************************************************************
-void dump_fps( vector<FingerprintBase *> &fps ) {
-
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    delete fps[i];
-  }
-  fps.clear();
-
-}
-
-// ****************************************************************************
+// open filename for reading, through a mapping, which is put in mapped, if
+// it can be, and as a gzFile otherwise.
 void open_fp_file( const string &filename ,
                    DAC_FINGERPRINTS::FP_FILE_FORMAT input_format ,
-                   bool &byteswapping  , gzFile &pfile) {
+                   bool &byteswapping  , gzFile &pfile ,
+                   scoped_ptr<MappedFingerprintFile> &mapped ) {
 
   byteswapping = false;
+  pfile = 0;
   try {
-    open_fp_file_for_reading( filename , input_format ,
-                              byteswapping , pfile );
+    if( MappedFingerprintFile::mappable( filename , input_format ) ) {
+      mapped.reset( new MappedFingerprintFile( filename , input_format ) );
+    } else {
+      open_fp_file_for_reading( filename , input_format ,
+                                byteswapping , pfile );
+    }
   } catch( DACLIB::FileReadOpenError &e ) {
     cerr << e.what() << endl;
     cout << e.what() << endl;
@@ -295,16 +305,51 @@ void open_fp_file( const string &filename ,
 }
 
 // ****************************************************************************
-void target_against_probes( const FingerprintBase *target_fp ,
-                            const vector<FingerprintBase *> &probe_fps ,
+// hit_nums and hit_dists
+// are workspace, passed in so they're only allocated the once. num_pruned
+// is incremented by the number of probes the folded prefilter rules out.
+// If bit_bound isn't null, probe_fps has been sorted by bit count, with
+// probe_order giving the original position of each, and only the probes with
+// bit counts that could be within the threshold are looked at.  The number
+// that aren't is added to num_skipped.
+// If nb_targets isn't null, target_num, the target's position in the target
+// file, is put in it alongside each neighbour added to nbs.
+void target_against_probes( const FingerprintView &target ,
+                            const FingerprintStore &probe_fps ,
                             double threshold , unsigned int min_count ,
-                            vector<pair<string,vector<pair<string,double> > > > &nbs ) {
+                            const TanimotoThreshold *bit_bound ,
+                            const vector<unsigned int> &probe_order ,
+                            vector<int> &hit_nums , vector<double> &hit_dists ,
+                            size_t &num_pruned , size_t &num_skipped ,
+                            vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                            size_t target_num = 0 ,
+                            vector<vector<size_t> > *nb_targets = 0 ) {
+
+  unsigned int start = 0 , stop = probe_fps.size();
+  if( bit_bound ) {
+    probe_fps.bit_bound_range( target.num_bits_set_ , *bit_bound ,
+                               start , stop );
+    num_skipped += probe_fps.size() - ( stop - start );
+    if( start == stop ) {
+      return;
+    }
+  }
 
-  for( int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
+  hit_nums.resize( probe_fps.size() );
+  hit_dists.resize( probe_fps.size() );
+  int num_hits = probe_fps.calc_distances( target , start , stop , threshold ,
+                                           &hit_nums[0] , &hit_dists[0] ,
+                                           &num_pruned );
+  if( !num_hits ) {
+    return;
+  }
+  string target_name = target.name();
+  for( int j = 0 ; j < num_hits ; ++j ) {
+    int i = bit_bound ? probe_order[hit_nums[j]] : hit_nums[j];
     if( !min_count || nbs[i].second.size() < min_count ) {
-      double dist = target_fp->calc_distance( *(probe_fps[i] ) , threshold );
-      if( dist <= threshold ) {
-        nbs[i].second.push_back( make_pair( target_fp->get_name() , dist ) );
+      nbs[i].second.push_back( make_pair( target_name , hit_dists[j] ) );
+      if( nb_targets ) {
+        (*nb_targets)[i].push_back( target_num );
       }
     }
   }
@@ -313,15 +358,21 @@ void target_against_probes( const FingerprintBase *target_fp ,
 
 // ****************************************************************************
 // the counts version.  If dist is 0.44, then counts[4] will be incremented
-void target_against_probes( const FingerprintBase *target_fp ,
-                            const vector<FingerprintBase *> &probe_fps ,
+void target_against_probes( const FingerprintView &target ,
+                            const FingerprintStore &probe_fps ,
+                            vector<double> &dists ,
                             vector<pair<string,vector<unsigned int> > > &counts ) {
 
+  dists.resize( probe_fps.size() );
+  probe_fps.calc_distances( target , 0 , probe_fps.size() , &dists[0] );
   for( int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
     // traditionally, we don't report the compound with itself, even though
-    // the test is going to slow things down badly.
-    if( probe_fps[i]->get_name() != target_fp->get_name() ) {
-      double dist = 10.0 * target_fp->calc_distance( *(probe_fps[i]) );
+    // the test is going to slow things down badly.  The target's name isn't
+    // null-terminated if it's come straight from a mapped file.
+    const char *probe_name = probe_fps.name_c_str( i );
+    if( strncmp( probe_name , target.name_ , target.name_len_ )
+        || probe_name[target.name_len_] ) {
+      double dist = 10.0 * dists[i];
       int cbin = int( dist );
       cbin = 10 == cbin ? 9 : cbin;
       // bins go to <= dist, so on the border is in the previous bin
@@ -334,72 +385,449 @@ void target_against_probes( const FingerprintBase *target_fp ,
 
 }
 
+// ****************************************************************************
+// the blocks of targets on their way from the reader threads to the search
+// threads of threaded_search, each with the position in the target file of
+// the first target in it.  There are never more than max_blocks waiting, so
+// the readers can't get too far ahead and fill the memory with targets.
+// The blocks go on in file order whatever order the readers finish them in,
+// as the searchers need them that way.
+class TargetQueue {
+
+public :
+
+  TargetQueue( unsigned int max_blocks , unsigned int num_readers ) :
+    max_blocks_( max_blocks ) , num_readers_( num_readers ) ,
+    next_chunk_( 0 ) , next_target_( 0 ) {}
+
+  // for readers sharing the file, the number of the first target of the
+  // next chunk_size of them for one to read
+  size_t claim_chunk( size_t chunk_size ) {
+    boost::mutex::scoped_lock lock( mutex_ );
+    size_t first_target = next_chunk_;
+    next_chunk_ += chunk_size;
+    return first_target;
+  }
+  void push( pFPS block , size_t first_target ) {
+    boost::mutex::scoped_lock lock( mutex_ );
+    while( blocks_.size() >= max_blocks_ || first_target != next_target_ ) {
+      not_full_.wait( lock );
+    }
+    blocks_.push_back( make_pair( first_target , block ) );
+    next_target_ = first_target + block->size();
+    not_empty_.notify_one();
+    // the reader with the block after this one may be waiting
+    not_full_.notify_all();
+  }
+  // a reader has finished, and when they all have, no more blocks are
+  // coming
+  void finish() {
+    boost::mutex::scoped_lock lock( mutex_ );
+    --num_readers_;
+    not_empty_.notify_all();
+  }
+  // wait for the next block. Returns false when there aren't any more.
+  bool pop( pFPS &block , size_t &first_target ) {
+    boost::mutex::scoped_lock lock( mutex_ );
+    while( blocks_.empty() && num_readers_ ) {
+      not_empty_.wait( lock );
+    }
+    if( blocks_.empty() ) {
+      return false;
+    }
+    first_target = blocks_.front().first;
+    block = blocks_.front().second;
+    blocks_.pop_front();
+    not_full_.notify_all();
+    return true;
+  }
+
+private :
+
+  unsigned int max_blocks_;
+  unsigned int num_readers_;
+  size_t next_chunk_ , next_target_;
+  deque<pair<size_t,pFPS> > blocks_;
+  boost::mutex mutex_;
+  boost::condition_variable not_empty_ , not_full_;
+
+};
+
+// ****************************************************************************
+// reads the targets TARGET_CHUNK_SIZE at a time and queues them up for the
+// search threads.  The file, either tfile or tmap if it's mapped, is read
+// sequentially, so there's only one of these, unless it's a block-compressed
+// file with an index, tindex, in which case there can be several, each
+// inflating the chunks it claims from the queue.
+class TargetReader {
+
+public :
+
+  TargetReader( const SatanSettings &ss , gzFile tfile , bool byteswapping ,
+                MappedFingerprintFile *tmap , const FingerprintIndex *tindex ,
+                TargetQueue &queue ) :
+    ss_( &ss ) , tfile_( tfile ) , byteswapping_( byteswapping ) ,
+    tmap_( tmap ) , tindex_( tindex ) , queue_( &queue ) , num_targets_( 0 ) {}
+
+  void operator()() {
+    if( tindex_ ) {
+      read_chunks();
+      queue_->finish();
+      return;
+    }
+    while( 1 ) {
+      pFPS block( new FingerprintStore );
+      if( tmap_ ) {
+        tmap_->read_fps( TARGET_CHUNK_SIZE , *block );
+      } else {
+        read_fps_from_file( tfile_ , byteswapping_ , ss_->input_format() ,
+                            ss_->bitstring_separator() , 0 , TARGET_CHUNK_SIZE ,
+                            *block );
+      }
+      if( block->empty() ) {
+        break;
+      }
+      queue_->push( block , num_targets_ );
+      num_targets_ += block->size();
+    }
+    queue_->finish();
+  }
+
+  size_t num_targets() const { return num_targets_; }
+
+private :
+
+  const SatanSettings *ss_;
+  gzFile tfile_;
+  bool byteswapping_;
+  MappedFingerprintFile *tmap_;
+  const FingerprintIndex *tindex_;
+  TargetQueue *queue_;
+  size_t num_targets_;
+
+  void read_chunks() {
+    while( 1 ) {
+      size_t first_target = queue_->claim_chunk( TARGET_CHUNK_SIZE );
+      if( first_target >= tindex_->size() ) {
+        break;
+      }
+      pFPS block( new FingerprintStore );
+      tindex_->read_fps( first_target , TARGET_CHUNK_SIZE , *block );
+      queue_->push( block , first_target );
+      num_targets_ += block->size();
+    }
+  }
+
+};
+
+// ****************************************************************************
+// one search thread of threaded_search.  It takes blocks of targets off the
+// queue and searches them against the probes into neighbour lists or counts
+// of its own, with the probe names left blank.  Its blocks come off the queue
+// in file order, so each of its neighbour lists is in target file order, and
+// nb_targets has the target numbers to go with them.
+class TargetSearcher {
+
+public :
+
+  TargetSearcher( const SatanSettings &ss , const FingerprintStore &probe_fps ,
+                  const TanimotoThreshold *bit_bound ,
+                  const vector<unsigned int> &probe_order ,
+                  TargetQueue &queue ) :
+    ss_( &ss ) , probe_fps_( &probe_fps ) , bit_bound_( bit_bound ) ,
+    probe_order_( &probe_order ) , queue_( &queue ) , num_pruned_( 0 ) ,
+    num_skipped_( 0 ) {}
+
+  void operator()() {
+    bool counts_output = string( "COUNTS" ) == ss_->output_format();
+    unsigned int num_probes = probe_fps_->size();
+    if( counts_output ) {
+      counts_ = vector<pair<string,vector<unsigned int> > >( num_probes ,
+                                                             make_pair( string() , vector<unsigned int>( 10 , 0 ) ) );
+    } else {
+      nbs_ = vector<pair<string,vector<pair<string,double> > > >( num_probes );
+      nb_targets_ = vector<vector<size_t> >( num_probes );
+    }
+    vector<int> hit_nums;
+    vector<double> hit_dists;
+    vector<uint32_t> frag_nums;
+    pFPS block;
+    size_t first_target;
+    while( queue_->pop( block , first_target ) ) {
+      for( unsigned int i = 0 , is = block->size() ; i < is ; ++i ) {
+        FingerprintView target = block->view( i , frag_nums );
+        if( counts_output ) {
+          target_against_probes( target , *probe_fps_ , hit_dists , counts_ );
+        } else {
+          target_against_probes( target , *probe_fps_ , ss_->threshold() ,
+                                 ss_->min_count() , bit_bound_ , *probe_order_ ,
+                                 hit_nums , hit_dists , num_pruned_ ,
+                                 num_skipped_ , nbs_ , first_target + i ,
+                                 &nb_targets_ );
+        }
+      }
+    }
+  }
+
+  vector<pair<string,vector<pair<string,double> > > > &nbs() { return nbs_; }
+  vector<vector<size_t> > &nb_targets() { return nb_targets_; }
+  vector<pair<string,vector<unsigned int> > > &counts() { return counts_; }
+  size_t num_pruned() const { return num_pruned_; }
+  size_t num_skipped() const { return num_skipped_; }
+
+private :
+
+  const SatanSettings *ss_;
+  const FingerprintStore *probe_fps_;
+  const TanimotoThreshold *bit_bound_;
+  const vector<unsigned int> *probe_order_;
+  TargetQueue *queue_;
+
+  vector<pair<string,vector<pair<string,double> > > > nbs_;
+  vector<vector<size_t> > nb_targets_;
+  vector<pair<string,vector<unsigned int> > > counts_;
+  size_t num_pruned_ , num_skipped_;
+
+};
+
+// ****************************************************************************
+// put the neighbours of probe i that the searchers found into nbs.  With a
+// min_count, each searcher has kept the first min_count it came across, and
+// of those, the first min_count in the target file are the ones a serial
+// search would have kept.
+void merge_neighbours( unsigned int min_count , unsigned int i ,
+                       vector<TargetSearcher> &searchers ,
+                       vector<pair<string,double> > &nbs ) {
+
+  if( !min_count ) {
+    for( unsigned int t = 0 , ts = searchers.size() ; t < ts ; ++t ) {
+      vector<pair<string,double> > &t_nbs = searchers[t].nbs()[i].second;
+      nbs.insert( nbs.end() , t_nbs.begin() , t_nbs.end() );
+      vector<pair<string,double> >().swap( t_nbs );
+    }
+    return;
+  }
+
+  vector<pair<size_t,pair<unsigned int,unsigned int> > > found;
+  for( unsigned int t = 0 , ts = searchers.size() ; t < ts ; ++t ) {
+    const vector<size_t> &t_targets = searchers[t].nb_targets()[i];
+    for( unsigned int j = 0 , js = t_targets.size() ; j < js ; ++j ) {
+      found.push_back( make_pair( t_targets[j] , make_pair( t , j ) ) );
+    }
+  }
+  sort( found.begin() , found.end() );
+  if( found.size() > min_count ) {
+    found.resize( min_count );
+  }
+  for( unsigned int k = 0 , ks = found.size() ; k < ks ; ++k ) {
+    nbs.push_back( searchers[found[k].second.first].nbs()[i].second[found[k].second.second] );
+  }
+  for( unsigned int t = 0 , ts = searchers.size() ; t < ts ; ++t ) {
+    vector<pair<string,double> >().swap( searchers[t].nbs()[i].second );
+    vector<size_t>().swap( searchers[t].nb_targets()[i] );
+  }
+
+}
+
+// ****************************************************************************
+// search the targets in tfile or tmap against the probes with a reader thread and
+// ss.num_threads() search threads, and merge the results into nbs or counts,
+// which have been set up with the probe names already.  If tindex isn't null,
+// the target file is block-compressed, and there are ss.num_threads() reader
+// threads inflating it in parallel instead.  The results are the
+// same as the serial search in process_fingerprints.
+void threaded_search( const SatanSettings &ss , gzFile tfile ,
+                      bool target_byteswapping , MappedFingerprintFile *tmap ,
+                      const FingerprintIndex *tindex ,
+                      const FingerprintStore &probe_fps ,
+                      const TanimotoThreshold *bit_bound ,
+                      const vector<unsigned int> &probe_order ,
+                      vector<pair<string,vector<pair<string,double> > > > &nbs ,
+                      vector<pair<string,vector<unsigned int> > > &counts ,
+                      size_t &num_targets , size_t &num_pruned ,
+                      size_t &num_skipped ) {
+
+  unsigned int num_readers = tindex ? ss.num_threads() : 1;
+  TargetQueue queue( 2 * ss.num_threads() , num_readers );
+  vector<TargetReader> readers( num_readers ,
+                                TargetReader( ss , tfile , target_byteswapping ,
+                                              tmap , tindex , queue ) );
+  vector<TargetSearcher> searchers( ss.num_threads() ,
+                                    TargetSearcher( ss , probe_fps , bit_bound ,
+                                                    probe_order , queue ) );
+
+  boost::thread_group threads;
+  for( unsigned int i = 0 ; i < num_readers ; ++i ) {
+    threads.create_thread( boost::ref( readers[i] ) );
+  }
+  for( int i = 0 ; i < ss.num_threads() ; ++i ) {
+    threads.create_thread( boost::ref( searchers[i] ) );
+  }
+  threads.join_all();
+  for( unsigned int i = 0 ; i < num_readers ; ++i ) {
+    num_targets += readers[i].num_targets();
+  }
+
+  for( unsigned int t = 0 , ts = searchers.size() ; t < ts ; ++t ) {
+    num_pruned += searchers[t].num_pruned();
+    num_skipped += searchers[t].num_skipped();
+    const vector<pair<string,vector<unsigned int> > > &t_counts = searchers[t].counts();
+    for( unsigned int i = 0 , is = t_counts.size() ; i < is ; ++i ) {
+      for( int j = 0 ; j < 10 ; ++j ) {
+        counts[i].second[j] += t_counts[i].second[j];
+      }
+    }
+  }
+  for( unsigned int i = 0 , is = nbs.size() ; i < is ; ++i ) {
+    merge_neighbours( ss.min_count() , i , searchers , nbs[i].second );
+  }
+
+}
+
 // ****************************************************************************
 void process_fingerprints( const SatanSettings &ss ,
                            unsigned int num_probe_fps , int chunk_num ,
                            vector<pair<string,vector<pair<string,double> > > > &nbs ,
                            vector<pair<string,vector<unsigned int> > > &counts ) {
 
-  gzFile pfile , tfile;
-  bool target_byteswapping , probe_byteswapping;
+  gzFile tfile;
+  bool target_byteswapping;
+  scoped_ptr<MappedFingerprintFile> tmap;
 
-  // read next lot of probe fps
-  open_fp_file( ss.probe_file() , ss.input_format() , probe_byteswapping , pfile );
-  vector<FingerprintBase *> probe_fps;
+  // read next lot of probe fps, going straight to them if the file's mapped
+  // or has an index
+  FingerprintStore probe_fps( ss.compact_frag_nums() );
   unsigned int start_probe_fp = num_probe_fps * chunk_num;
-  read_fps_from_file( pfile , probe_byteswapping , ss.input_format() ,
-                      ss.bitstring_separator() , start_probe_fp ,
-                      num_probe_fps , probe_fps );
+  try {
+    read_fps_from_file( ss.probe_file() , ss.input_format() ,
+                        ss.bitstring_separator() , start_probe_fp ,
+                        num_probe_fps , probe_fps );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    cout << e.what() << endl;
+    exit( 1 );
+  }
 
   if( probe_fps.empty() ) {
     cerr << "Error : premature end of file " << ss.probe_file() << endl;
-    gzclose( pfile );
     exit( 1 );
   }
   if( ss.warm_feeling() ) {
     cout << "Read " << probe_fps.size() << " probes." << endl;
   }
+  probe_fps.set_fold_bits( ss.fold_bits() );
 
   if( string( "COUNTS" ) == ss.output_format() ) {
     counts.reserve( probe_fps.size() );
-    BOOST_FOREACH( FingerprintBase *pfp , probe_fps ) {
-      counts.push_back( make_pair( pfp->get_name() , vector<unsigned int>( 10 , 0 ) ) );
+    for( unsigned int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
+      counts.push_back( make_pair( probe_fps.name( i ) , vector<unsigned int>( 10 , 0 ) ) );
     }
   } else {
     nbs.reserve( probe_fps.size() );
-    BOOST_FOREACH( FingerprintBase *pfp , probe_fps ) {
-      nbs.push_back( make_pair( pfp->get_name() , vector<pair<string,double> >() ) );
+    for( unsigned int i = 0 , is = probe_fps.size() ; i < is ; ++i ) {
+      nbs.push_back( make_pair( probe_fps.name( i ) , vector<pair<string,double> >() ) );
     }
   }
 
-  open_fp_file( ss.target_file() , ss.input_format() , target_byteswapping , tfile );
-
-  int num_targets = 0;
+  // for Tanimoto neighbour lists, sort the probes by bit count so each
+  // target need only look at those whose counts are close enough to its own
+  // to be within the threshold.
   bool counts_output = string( "COUNTS" ) == ss.output_format() ? true : false;
+  scoped_ptr<TanimotoThreshold> bit_bound;
+  vector<unsigned int> probe_order;
+  if( !counts_output && TANIMOTO == ss.similarity_calc() ) {
+    bit_bound.reset( new TanimotoThreshold( ss.threshold() ) );
+    probe_fps.sort_by_num_bits_set( probe_order );
+  }
 
-  while( 1 ) {
-    FingerprintBase *target_fp = read_next_fp_from_file( tfile , target_byteswapping ,
-                                                         ss.input_format() ,
-                                                         ss.bitstring_separator() );
-    if( !target_fp ) {
-      break;
+  unsigned int probe_num_ints = HashedFingerprint::num_ints();
+  open_fp_file( ss.target_file() , ss.input_format() , target_byteswapping ,
+                tfile , tmap );
+  // mapped targets don't go into a store that would notice
+  if( probe_fps.hashed() && HashedFingerprint::num_ints() != probe_num_ints ) {
+    cerr << HashedFingerprintLengthError( HashedFingerprint::num_ints() ,
+                                          probe_num_ints ).what() << endl;
+    exit( 1 );
+  }
+
+  // a block-compressed target file can be inflated by several threads at once
+  scoped_ptr<FingerprintIndex> tindex;
+  if( !tmap && ss.num_threads() > 1 ) {
+    tindex.reset( FingerprintIndex::open( ss.target_file() , ss.input_format() ) );
+    if( tindex && !tindex->block_compressed() ) {
+      tindex.reset();
     }
-    ++num_targets;
+  }
 
-    if( counts_output ) {
-      target_against_probes( target_fp , probe_fps , counts );
-    } else {
-      target_against_probes( target_fp , probe_fps , ss.threshold() ,
-                             ss.min_count() , nbs );
+  size_t num_targets = 0 , num_pruned = 0 , num_skipped = 0;
+  if( ss.num_threads() > 1 ) {
+    threaded_search( ss , tfile , target_byteswapping , tmap.get() ,
+                     tindex.get() , probe_fps ,
+                     bit_bound.get() , probe_order , nbs , counts , num_targets ,
+                     num_pruned , num_skipped );
+  } else if( tmap ) {
+    // an uncompressed target file is searched where it lies, without
+    // reading or copying the fingerprints at all.
+    vector<int> hit_nums;
+    vector<double> hit_dists;
+    FingerprintView target;
+    while( tmap->next( target ) ) {
+      ++num_targets;
+      if( counts_output ) {
+        target_against_probes( target , probe_fps , hit_dists , counts );
+      } else {
+        target_against_probes( target , probe_fps , ss.threshold() ,
+                               ss.min_count() , bit_bound.get() , probe_order ,
+                               hit_nums , hit_dists , num_pruned , num_skipped ,
+                               nbs );
+      }
+    }
+  } else {
+    vector<int> hit_nums;
+    vector<double> hit_dists;
+    vector<uint32_t> frag_nums;
+    // the targets are read a chunk at a time in the background, so the next
+    // chunk is decompressed while this one's searched.
+    FingerprintBlockReader target_reader( tfile , target_byteswapping ,
+                                          ss.input_format() ,
+                                          ss.bitstring_separator() ,
+                                          TARGET_CHUNK_SIZE );
+
+    while( const FingerprintStore *target_block = target_reader.next_block() ) {
+      const FingerprintStore &target_fps = *target_block;
+      num_targets += target_fps.size();
+
+      for( unsigned int i = 0 , is = target_fps.size() ; i < is ; ++i ) {
+        FingerprintView target = target_fps.view( i , frag_nums );
+        if( counts_output ) {
+          target_against_probes( target , probe_fps , hit_dists , counts );
+        } else {
+          target_against_probes( target , probe_fps , ss.threshold() ,
+                                 ss.min_count() , bit_bound.get() , probe_order ,
+                                 hit_nums , hit_dists , num_pruned , num_skipped ,
+                                 nbs );
+        }
+      }
     }
-    delete target_fp;
   }
 
-  gzclose( pfile );
-  gzclose( tfile );
+  if( ss.warm_feeling() && bit_bound ) {
+    cout << "Bit count bounds skipped " << num_skipped << " of "
+         << num_targets * probe_fps.size() << " pairs." << endl;
+  }
+  if( ss.warm_feeling() && probe_fps.hashed() && probe_fps.fold_bits() &&
+      !counts_output ) {
+    cout << "Folded prefilter ruled out " << num_pruned << " of "
+         << num_targets * probe_fps.size() << " pairs." << endl;
+  }
 
-  // we're done with probes
-  dump_fps( probe_fps );
+  if( tfile ) {
+    gzclose( tfile );
+  }
 
   // sort the neighbour lists ready for output
   for( int i = 0 , is = nbs.size() ; i < is ; ++i ) {
@@ -5,13 +5,23 @@
 // 28th February 2007
 //
 // Does what it says on the tin.
+// It can make several subsets at once, each from its own names file and
+// to its own output file, or from a partition file that gives the output
+// file for each name.  The fingerprint file is read once, a fingerprint at
+// a time, and each one written to whichever subsets have its name, so only
+// the names are held in memory.  A version 2 flush file is read through a
+// mapping and its subsets written as version 2 files.
 
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <string>
 #include <vector>
 
 #include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
@@ -19,7 +29,9 @@
 
 #include "FileExceptions.H"
 #include "FingerprintBase.H"
+#include "FlushV2File.H"
 #include "HashedFingerprint.H"
+#include "MappedFingerprintFile.H"
 #include "NotHashedFingerprint.H"
 
 using namespace std;
@@ -29,22 +41,46 @@ namespace po = boost::program_options;
 
 extern string BUILD_TIME;
 
+// the numbers of the subsets each name is in.  Most names will only be in
+// one, so it's a multimap rather than a map of vectors.
+typedef boost::unordered_multimap<string , unsigned int> SUBSET_NAMES;
+
+// ***********************************************************************
+// an output file and how many fingerprints have gone into it
+struct SubsetOutput {
+
+  SubsetOutput( const string &filename ) :
+    filename_( filename ) , gzfp_( 0 ) , ucfp_( 0 ) , num_written_( 0 ) {}
+
+  string filename_;
+  gzFile gzfp_;
+  FILE   *ucfp_;
+  boost::shared_ptr<FlushV2Writer> v2fp_; // for version 2 input
+  size_t num_written_;
+
+};
+
 // ***********************************************************************
 void build_program_options( po::options_description &desc ,
                             string &input_fp_file ,
-                            string &subset_names_file , string &output_file ,
+                            vector<string> &subset_names_files ,
+                            vector<string> &output_files ,
+                            string &partition_file ,
                             string &format_string , string &bitstring_separator ,
                             bool &warm_feeling ) {
 
   desc.add_options()
       ( "help" , "Produce help text." )
-      ( "output-file,O" , po::value<string>( &output_file ) , "Output filename" )
+      ( "output-file,O" , po::value<vector<string> >( &output_files ) ,
+        "Output filename, one for each subset names file." )
       ( "input-fp-file,I" , po::value<string>( &input_fp_file ) ,
         "Input filename" )
       ( "input-format,F" , po::value<string>( &format_string ) ,
-        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS (default FLUSH_FPS)" )
-      ( "subset-names-file,S" , po::value<string>( &subset_names_file ) ,
-        "Name of file containing names for subset." )
+        "Input format : FLUSH_FPS|BITSTRINGS|BIN_FRAG_NUMS|FRAG_NUMS|FPS (default FLUSH_FPS)" )
+      ( "subset-names-file,S" , po::value<vector<string> >( &subset_names_files ) ,
+        "Name of file containing names for subset. May be given more than once, with an output file for each." )
+      ( "partition-file,P" , po::value<string>( &partition_file ) ,
+        "Name of file with a fingerprint name and the output file it's to go in on each line." )
       ( "verbose,V" , po::value<bool>( &warm_feeling )->zero_tokens() ,
         "Verbose mode" )
       ( "warm-feeling,W" , po::value<bool>( &warm_feeling )->zero_tokens() ,
@@ -71,13 +107,19 @@ void verify_program_options( po::options_description &desc ,
     exit( 1 );
   }
 
-  if( !vm.count( "output-file" ) ) {
-    cerr << "Need an output_file." << endl << desc << endl;
+  if( !vm.count( "subset-names-file" ) && !vm.count( "partition-file" ) ) {
+    cerr << "Need a subset names file or a partition file." << endl
+         << desc << endl;
     exit( 1 );
   }
 
-  if( !vm.count( "subset-names-file" ) ) {
-    cerr << "Need a subset names file." << endl << desc << endl;
+  size_t num_names_files = vm.count( "subset-names-file" ) ?
+      vm["subset-names-file"].as<vector<string> >().size() : 0;
+  size_t num_output_files = vm.count( "output-file" ) ?
+      vm["output-file"].as<vector<string> >().size() : 0;
+  if( num_names_files != num_output_files ) {
+    cerr << "Need an output file for each subset names file." << endl
+         << desc << endl;
     exit( 1 );
   }
 
@@ -87,8 +129,24 @@ void verify_program_options( po::options_description &desc ,
 }
 
 // *******************************************************************************
-void read_subset_names( const string &subset_names_file , bool warm_feeling ,
-                        vector<string> &subset_names ) {
+// add name to subset_names for subset_num, unless it's there already
+void add_subset_name( const string &name , unsigned int subset_num ,
+                      SUBSET_NAMES &subset_names ) {
+
+  pair<SUBSET_NAMES::iterator , SUBSET_NAMES::iterator> its =
+      subset_names.equal_range( name );
+  for( ; its.first != its.second ; ++its.first ) {
+    if( its.first->second == subset_num ) {
+      return;
+    }
+  }
+  subset_names.insert( make_pair( name , subset_num ) );
+
+}
+
+// *******************************************************************************
+void read_subset_names( const string &subset_names_file , unsigned int subset_num ,
+                        bool warm_feeling , SUBSET_NAMES &subset_names ) {
 
   ifstream ifs( subset_names_file.c_str() );
   if( !ifs || !ifs.good() ) {
@@ -96,30 +154,59 @@ void read_subset_names( const string &subset_names_file , bool warm_feeling ,
   }
 
   string next_name;
+  size_t num_read = 0;
   while( 1 ) {
     ifs >> next_name;
     if( ifs.eof() || ifs.fail() )
       break;
-    subset_names.push_back( next_name );
+    add_subset_name( next_name , subset_num , subset_names );
+    ++num_read;
   }
 
   if( warm_feeling )
-    cout << "Read " << subset_names.size() << " from file " << subset_names_file
+    cout << "Read " << num_read << " from file " << subset_names_file
          << endl;
 
-  bool needs_sorting = false;
-  for( int i = 0 , j = 1 , is = subset_names.size() - 1 ; i < is ; ++i , ++j )
-    if( subset_names[i] > subset_names[j] ) {
-      needs_sorting = true;
+}
+
+// *******************************************************************************
+// each line of the partition file is a fingerprint name and the output file
+// it goes in.  New output files go on the end of outputs.
+void read_partition_file( const string &partition_file , bool warm_feeling ,
+                          SUBSET_NAMES &subset_names ,
+                          vector<SubsetOutput> &outputs ) {
+
+  ifstream ifs( partition_file.c_str() );
+  if( !ifs || !ifs.good() ) {
+    cerr << "Error opening " << partition_file << " for reading." << endl;
+    exit( 1 );
+  }
+
+  map<string , unsigned int> output_nums;
+  for( unsigned int i = 0 , is = outputs.size() ; i < is ; ++i ) {
+    output_nums.insert( make_pair( outputs[i].filename_ , i ) );
+  }
+
+  string next_name , next_output;
+  size_t num_read = 0;
+  while( 1 ) {
+    ifs >> next_name >> next_output;
+    if( ifs.eof() || ifs.fail() )
       break;
+    map<string , unsigned int>::iterator it = output_nums.find( next_output );
+    if( output_nums.end() == it ) {
+      it = output_nums.insert( make_pair( next_output ,
+                                          outputs.size() ) ).first;
+      outputs.push_back( SubsetOutput( next_output ) );
     }
-
-  if( needs_sorting ) {
-    if( warm_feeling )
-      cout << "Sorting subset names." << endl;
-    sort( subset_names.begin() , subset_names.end() );
+    add_subset_name( next_name , it->second , subset_names );
+    ++num_read;
   }
 
+  if( warm_feeling )
+    cout << "Read " << num_read << " names for " << output_nums.size()
+         << " output files from file " << partition_file << endl;
+
 }
 
 // *************************************************************************
@@ -129,14 +216,19 @@ void open_output_file( const string &output_file , FP_FILE_FORMAT fp_file_format
   boost::regex gzip( ".*\\.gz" );
   bool compr = boost::regex_match( output_file , gzip );
 
-  if( compr ) {
-    open_fp_file_for_writing( output_file , HashedFingerprint::num_ints() * sizeof( unsigned int ) ,
-                              fp_file_format , gzfp );
-    ucfp = 0;
-  } else {
-    open_fp_file_for_writing( output_file , HashedFingerprint::num_ints() * sizeof( unsigned int ) ,
-                              fp_file_format , ucfp );
-    gzfp = 0;
+  try {
+    if( compr ) {
+      open_fp_file_for_writing( output_file , HashedFingerprint::num_ints() * sizeof( unsigned int ) ,
+                                fp_file_format , gzfp );
+      ucfp = 0;
+    } else {
+      open_fp_file_for_writing( output_file , HashedFingerprint::num_ints() * sizeof( unsigned int ) ,
+                                fp_file_format , ucfp );
+      gzfp = 0;
+    }
+  } catch( DACLIB::FileWriteOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
   }
 
 }
@@ -161,34 +253,113 @@ void write_fp_to_file( const FingerprintBase &fp , gzFile &gzfp ,
       fp.ascii_write( ucfp , bitstring_separator );
     }
     break;
+  case FPS :
+    if( gzfp ) {
+      static_cast<const HashedFingerprint &>( fp ).fps_write( gzfp );
+    } else {
+      static_cast<const HashedFingerprint &>( fp ).fps_write( ucfp );
+    }
+    break;
   }
 
 }
 
-// *******************************************************************************
-int main( int argc , char **argv ) {
+// *************************************************************************
+// read the next fingerprint into fp, which is re-used for each one
+bool read_next_fp( gzFile infp , bool byteswapping ,
+                   FP_FILE_FORMAT fp_file_format ,
+                   const string &bitstring_separator , FingerprintBase &fp ) {
 
-  string input_fp_file , subset_names_file , output_file;
-  string format_string , bitstring_separator;
-  bool warm_feeling( false ) , binary_file( false );
-  po::options_description desc( "Allowed Options" );
-  build_program_options( desc , input_fp_file , subset_names_file ,
-                         output_file , format_string , bitstring_separator ,
-                         warm_feeling );
+  try {
+    switch( fp_file_format ) {
+    case FLUSH_FPS : case BIN_FRAG_NUMS :
+      return fp.binary_read( infp , byteswapping );
+    case BITSTRINGS : case FRAG_NUMS :
+      return fp.ascii_read( infp , bitstring_separator );
+    case FPS :
+      return static_cast<HashedFingerprint &>( fp ).fps_read( infp );
+    }
+  } catch( HashedFingerprintLengthError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
 
-  po::variables_map vm;
-  po::store( po::parse_command_line( argc , argv , desc ) , vm );
-  po::notify( vm );
+  return false;
 
-  verify_program_options( desc , vm , argc , warm_feeling );
+}
 
-  FP_FILE_FORMAT fp_file_format( FLUSH_FPS );
-  if( format_string.empty() ) {
-    format_string = "FLUSH_FPS";
+// *************************************************************************
+void open_output_files( FP_FILE_FORMAT fp_file_format ,
+                        vector<SubsetOutput> &outputs ) {
+
+  for( int i = 0 , is = outputs.size() ; i < is ; ++i ) {
+    open_output_file( outputs[i].filename_ , fp_file_format ,
+                      outputs[i].gzfp_ , outputs[i].ucfp_ );
   }
 
-  decode_format_string( format_string , fp_file_format , binary_file ,
-                        bitstring_separator );
+}
+
+// *************************************************************************
+// the subsets of a version 2 flush file, as version 2 files
+size_t subset_v2( const string &input_fp_file ,
+                  const SUBSET_NAMES &subset_names ,
+                  vector<SubsetOutput> &outputs ) {
+
+  scoped_ptr<MappedFingerprintFile> mapped;
+  try {
+    mapped.reset( new MappedFingerprintFile( input_fp_file , FLUSH_FPS ) );
+  } catch( DACLIB::FileReadOpenError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  } catch( FingerprintFileError &e ) {
+    cerr << e.what() << endl;
+    exit( 1 );
+  }
+
+  boost::regex gzip( ".*\\.gz" );
+  for( int i = 0 , is = outputs.size() ; i < is ; ++i ) {
+    if( boost::regex_match( outputs[i].filename_ , gzip ) ) {
+      cerr << "Version 2 flush files can't be compressed, so can't be written"
+           << " to " << outputs[i].filename_ << "." << endl
+           << "Use merge_fp_files to convert " << input_fp_file
+           << " to version 1 first." << endl;
+      exit( 1 );
+    }
+    try {
+      outputs[i].v2fp_.reset( new FlushV2Writer( outputs[i].filename_ ,
+                                                 HashedFingerprint::num_ints() * sizeof( unsigned int ) ) );
+    } catch( DACLIB::FileWriteOpenError &e ) {
+      cerr << e.what() << endl;
+      exit( 1 );
+    }
+  }
+
+  size_t num_read = 0;
+  FingerprintView fp;
+  while( mapped->next( fp ) ) {
+    ++num_read;
+    string fp_name = fp.name();
+    pair<SUBSET_NAMES::const_iterator , SUBSET_NAMES::const_iterator> its =
+        subset_names.equal_range( fp_name );
+    for( ; its.first != its.second ; ++its.first ) {
+      SubsetOutput &output = outputs[its.first->second];
+      output.v2fp_->write( fp_name ,
+                           reinterpret_cast<const unsigned int *>( fp.bits_ ) );
+      ++output.num_written_;
+    }
+  }
+
+  return num_read;
+
+}
+
+// *************************************************************************
+// the subsets of anything else, in the same format
+size_t subset_stream( const string &input_fp_file ,
+                      FP_FILE_FORMAT fp_file_format , bool binary_file ,
+                      const string &bitstring_separator ,
+                      const SUBSET_NAMES &subset_names ,
+                      vector<SubsetOutput> &outputs ) {
 
   bool byteswapping = false;
   gzFile gzfp = 0;
@@ -207,35 +378,104 @@ int main( int argc , char **argv ) {
     exit( 1 );
   }
 
-  vector<FingerprintBase *> fps;
-  read_fp_file( gzfp , byteswapping , fp_file_format ,
-                bitstring_separator , fps );
-  if( warm_feeling ) {
-    cout << "Read " << fps.size() << " fingerprints" << endl;
+  scoped_ptr<FingerprintBase> fp;
+  if( FLUSH_FPS == fp_file_format || BITSTRINGS == fp_file_format
+      || FPS == fp_file_format ) {
+    fp.reset( new HashedFingerprint( "Dummy" ) );
+  } else {
+    fp.reset( new NotHashedFingerprint( "Dummy" ) );
   }
 
+  // the output files are opened after the first fingerprint's read, when
+  // the size of them is known for text files.
+  size_t num_read = 0;
+  while( read_next_fp( gzfp , byteswapping , fp_file_format ,
+                       bitstring_separator , *fp ) ) {
+    if( !num_read++ ) {
+      open_output_files( fp_file_format , outputs );
+    }
+    pair<SUBSET_NAMES::const_iterator , SUBSET_NAMES::const_iterator> its =
+        subset_names.equal_range( fp->get_name() );
+    for( ; its.first != its.second ; ++its.first ) {
+      SubsetOutput &output = outputs[its.first->second];
+      write_fp_to_file( *fp , output.gzfp_ , output.ucfp_ , fp_file_format ,
+                        bitstring_separator );
+      ++output.num_written_;
+    }
+  }
+  if( !num_read ) {
+    open_output_files( fp_file_format , outputs );
+  }
   gzclose( gzfp );
 
-  vector<string> subset_names;
-  read_subset_names( subset_names_file , warm_feeling , subset_names );
+  return num_read;
 
-  gzfp = 0; // for binary formats
-  FILE *ucfp = 0;
-  open_output_file( output_file , fp_file_format , gzfp , ucfp );
+}
 
-  for( int i = 0 , is = fps.size() ; i < is ; ++i ) {
-    if( binary_search( subset_names.begin() , subset_names.end() ,
-                       fps[i]->get_name() ) ) {
-      write_fp_to_file( *fps[i] , gzfp , ucfp , fp_file_format ,
+// *******************************************************************************
+int main( int argc , char **argv ) {
+
+  string input_fp_file , partition_file;
+  vector<string> subset_names_files , output_files;
+  string format_string , bitstring_separator;
+  bool warm_feeling( false ) , binary_file( false );
+  po::options_description desc( "Allowed Options" );
+  build_program_options( desc , input_fp_file , subset_names_files ,
+                         output_files , partition_file , format_string ,
+                         bitstring_separator , warm_feeling );
+
+  po::variables_map vm;
+  po::store( po::parse_command_line( argc , argv , desc ) , vm );
+  po::notify( vm );
+
+  verify_program_options( desc , vm , argc , warm_feeling );
+
+  FP_FILE_FORMAT fp_file_format( FLUSH_FPS );
+  if( format_string.empty() ) {
+    format_string = "FLUSH_FPS";
+  }
+
+  decode_format_string( format_string , fp_file_format , binary_file ,
                         bitstring_separator );
-    }
+
+  SUBSET_NAMES subset_names;
+  vector<SubsetOutput> outputs;
+  for( unsigned int i = 0 , is = subset_names_files.size() ; i < is ; ++i ) {
+    outputs.push_back( SubsetOutput( output_files[i] ) );
+    read_subset_names( subset_names_files[i] , i , warm_feeling ,
+                       subset_names );
+  }
+  if( !partition_file.empty() ) {
+    read_partition_file( partition_file , warm_feeling , subset_names ,
+                         outputs );
   }
 
-  if( gzfp ) {
-    gzclose( gzfp );
+  size_t num_read = 0;
+  if( FLUSH_FPS == fp_file_format
+      && MappedFingerprintFile::flush_v2( input_fp_file ) ) {
+    num_read = subset_v2( input_fp_file , subset_names , outputs );
+  } else {
+    num_read = subset_stream( input_fp_file , fp_file_format , binary_file ,
+                              bitstring_separator , subset_names , outputs );
   }
-  if( ucfp ) {
-    fclose( ucfp );
+
+  if( warm_feeling ) {
+    cout << "Read " << num_read << " fingerprints" << endl;
+  }
+  for( int i = 0 , is = outputs.size() ; i < is ; ++i ) {
+    if( warm_feeling ) {
+      cout << "Wrote " << outputs[i].num_written_ << " to "
+           << outputs[i].filename_ << endl;
+    }
+    if( outputs[i].gzfp_ ) {
+      gzclose( outputs[i].gzfp_ );
+    }
+    if( outputs[i].ucfp_ ) {
+      fclose( outputs[i].ucfp_ );
+    }
+    if( outputs[i].v2fp_ ) {
+      outputs[i].v2fp_->finish();
+    }
   }
 
 }